@@ -0,0 +1,121 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+/* Checks that simulations make no heap allocations    */
+/* Built with SIM_ALLOC_ACCOUNTING defined              */
+
+#include "core_api.h"
+#include "sim_api.h"
+#include "sim_alloc.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <stdio.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+using namespace std;
+
+static bool endsWith(const string& str, const string& suffix){
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/**
+ * adds the images of a path, directories contribute their .in and .img files
+ * @return false if the path does not exist
+ */
+static bool collectImages(const string& path, vector<string>& images){
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    if (!S_ISDIR(st.st_mode)){
+        images.push_back(path);
+        return true;
+    }
+    DIR* dir = opendir(path.c_str());
+    if (dir == NULL)
+        return false;
+    vector<string> found;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL){
+        string name = entry->d_name;
+        if (endsWith(name, ".in") || endsWith(name, ".img"))
+            found.push_back(path + "/" + name);
+    }
+    closedir(dir);
+    sort(found.begin(), found.end());
+    images.insert(images.end(), found.begin(), found.end());
+    return true;
+}
+
+/**
+ * heap allocations of a run
+ */
+struct RunAllocs{
+    unsigned long core; // made by the core, must be none but the state of a host thread per core after the first
+    unsigned long data; // data pages the memory simulator allocated for the stores of the run
+};
+
+/**
+ * runs one model over the context and counts the allocations of the run itself, not of creating or destroying the core
+ */
+static RunAllocs countRun(SIM_Context* ctx, core_model model){
+    CORE_Sim* sim = CORE_Create(ctx, model);
+    unsigned long before = SIM_AllocCount(), beforeNoted = SIM_AllocNotedCount();
+    CORE_Run(sim);
+    unsigned long noted = SIM_AllocNotedCount() - beforeNoted;
+    unsigned long hosts = CORE_GetCoresNum(sim) - 1; // starting a std::thread allocates its state
+    RunAllocs allocs = {SIM_AllocCount() - before - noted - hosts, noted};
+    CORE_Destroy(sim);
+    return allocs;
+}
+
+/**
+ * runs both models over an image twice. no run may allocate in the core, and the second runs may only allocate
+ * the data pages of stores whose addresses were loaded from memory the first runs changed
+ * @param dataPages - incremented by the data pages of the second runs
+ * @return true if the core made no allocations
+ */
+static bool checkImage(const string& image, unsigned long& dataPages){
+    SIM_Context* ctx = SIM_CtxCreate(image.c_str());
+    if (ctx == NULL){
+        printf("ERROR %s\n", image.c_str());
+        return false;
+    }
+    bool ok = true;
+    for (int round = 0; round < 2; round++){
+        for (int model = CORE_MODEL_BLOCKED; model <= CORE_MODEL_FINEGRAINED; model++){
+            RunAllocs allocs = countRun(ctx, (core_model)model);
+            if (allocs.core > 0){
+                printf("FAIL  %s: %lu allocations in %s MT\n", image.c_str(), allocs.core,
+                       model == CORE_MODEL_BLOCKED ? "blocked" : "fine-grained");
+                ok = false;
+            }
+            if (round > 0)
+                dataPages += allocs.data;
+        }
+    }
+    SIM_CtxFree(ctx);
+    return ok;
+}
+
+int main(int argc, char const *argv[]){
+    if (argc < 2){
+        fprintf(stderr, "usage: %s <image or directory>...\n", argv[0]);
+        return 1;
+    }
+    vector<string> images;
+    for (int i = 1; i < argc; i++){
+        if (!collectImages(argv[i], images)){
+            fprintf(stderr, "No such image or directory: %s\n", argv[i]);
+            return 2;
+        }
+    }
+    int failed = 0;
+    unsigned long dataPages = 0;
+    for (size_t i = 0; i < images.size(); i++)
+        failed += !checkImage(images[i], dataPages);
+    printf("%zu images: %zu without allocations in the simulation loop, %d failed\n",
+           images.size(), images.size() - failed, failed);
+    printf("%lu data memory allocations in repeated runs\n", dataPages);
+    return failed ? 1 : 0;
+}
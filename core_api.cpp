@@ -1,136 +1,565 @@
 /* 046267 Computer Architecture - Spring 2020 - HW #4 */
 
 #include "core_api.h"
+#include "data_cache.h"
+#include "memory_queue.h"
 #include "sim_api.h"
+#include "thread_bitmap.h"
 #include "vector"
 
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <string>
 
 using namespace std;
 
+#define CACHE_LINE_SIZE 64
+
+/* statements that only builds with SIM_STATS defined compile, so accounting costs nothing otherwise */
+#ifdef SIM_STATS
+#define STATS(statement) statement
+#else
+#define STATS(statement)
+#endif
+
 /**
- * class containing the entire context of a thread
+ * class containing the entire context of all threads of a core.
+ * every field is a dense array indexed by thread id, and the register files lie back to back
+ * in a single cache line aligned block, so neighbouring threads share cache lines.
  */
-class ThreadData{
+class ThreadStore{
 public:
-    int tid;
-    bool isHalt;
-    int cyclesOnHold;
-    tcontext* context;
-    int lastLine;
-    ThreadData(int tid): tid(tid), isHalt(false), cyclesOnHold(0), lastLine(-1){
-        context = new tcontext();
-    }
-    ~ThreadData(){
-        delete context;
-    }
+    int count;
+    tcontext* regs; // register file of every thread
+    std::vector<char> isHalt;
+    std::vector<long long> readyAt; // first tick in which the thread may run again
+    std::vector<int> lastLine; // last instruction line the thread executed
+    std::vector<double> haltCycle; // core cycle in which the thread halted, 0 if it did not
+    std::vector<char> heldOnLoad; // the thread is held by a LOAD rather than a STORE
+    std::vector<long long> loadDoneAt; // scoreboard mode: tick in which the data of the last LOAD of the thread returns
+    explicit ThreadStore(int count);
+    ~ThreadStore();
+    ThreadStore(const ThreadStore&) = delete;
+    ThreadStore& operator=(const ThreadStore&) = delete;
+};
+
+ThreadStore::ThreadStore(int count): count(count), regs(NULL), isHalt(count, false), readyAt(count, 0),
+                                     lastLine(count, -1), haltCycle(count, 0), heldOnLoad(count, false),
+                                     loadDoneAt(count, 0){
+    size_t size = sizeof(tcontext) * (count > 0 ? count : 1);
+    void* block = NULL;
+    if (posix_memalign(&block, CACHE_LINE_SIZE, size) != 0)
+        throw std::bad_alloc();
+    memset(block, 0, size);
+    regs = (tcontext*)block;
+}
+
+ThreadStore::~ThreadStore(){
+    free(regs);
+}
+
+/**
+ * decoded form of an instruction, every opcode/operand-kind pair gets its own handler
+ */
+enum MicroOpKind{
+    UOP_NOP = 0,
+    UOP_ADD_REG,    // dst <- src1 + src2
+    UOP_ADD_IMM,    // dst <- src1 + imm
+    UOP_SUB_REG,    // dst <- src1 - src2
+    UOP_SUB_IMM,    // dst <- src1 - imm
+    UOP_LOAD_REG,   // dst <- Mem[src1 + src2]
+    UOP_LOAD_IMM,   // dst <- Mem[src1 + imm]
+    UOP_STORE_REG,  // Mem[dst + src2] <- src1
+    UOP_STORE_IMM,  // Mem[dst + imm] <- src1
+    UOP_HALT,
+};
+
+struct MicroOp{
+    uint8_t kind;
+    uint8_t dst;
+    uint8_t src1;
+    uint8_t src2;
+    int32_t imm;
 };
 
+/**
+ * lowers a simulator instruction into a micro op
+ * @param inst - instruction to decode
+ * @return the matching micro op
+ */
+static MicroOp decodeInstruction(const Instruction* inst){
+    MicroOp uop = {UOP_NOP, 0, 0, 0, 0};
+    switch (inst->opcode) {
+        case CMD_ADD:
+        case CMD_ADDI: // ADD and ADDI differ only in the kind of src2 they get
+            uop.kind = inst->isSrc2Imm ? UOP_ADD_IMM : UOP_ADD_REG;
+            break;
+        case CMD_SUB:
+        case CMD_SUBI:
+            uop.kind = inst->isSrc2Imm ? UOP_SUB_IMM : UOP_SUB_REG;
+            break;
+        case CMD_LOAD:
+            uop.kind = inst->isSrc2Imm ? UOP_LOAD_IMM : UOP_LOAD_REG;
+            break;
+        case CMD_STORE:
+            uop.kind = inst->isSrc2Imm ? UOP_STORE_IMM : UOP_STORE_REG;
+            break;
+        case CMD_HALT:
+            uop.kind = UOP_HALT;
+            return uop;
+        default:
+            return uop;
+    }
+    uop.dst = (uint8_t)inst->dst_index;
+    uop.src1 = (uint8_t)inst->src1_index;
+    if (inst->isSrc2Imm)
+        uop.imm = inst->src2_index_imm;
+    else
+        uop.src2 = (uint8_t)inst->src2_index_imm;
+    assert(uop.dst < REGS_COUNT && uop.src1 < REGS_COUNT && uop.src2 < REGS_COUNT);
+    return uop;
+}
+
 /**
  * base class for a core
  */
 class baseCore{
 protected:
+    SIM_Context* ctx; // image the core runs
+    std::vector<int> threadIds; // thread of the image behind every thread of the core
+    int loadLat;
+    int storeLat;
+    int switchCycles;
     int numOfThreads;
-    std::vector<ThreadData*>* threads;
+    ThreadStore threads;
     double cycles;
     double instructionCounter;
     bool _nop;
     bool _isIdle;
+    int liveThreads; // threads that did not halt yet
+    int runningThread; // thread of the next cycle, kept between the slices of a bounded run
+    long long tick; // number of cycles the hold clock advanced, the base of all readyAt stamps
+    std::vector<std::pair<long long, int> > wakeUps; // min-heap of (readyAt, tid) of waiting threads
+    ThreadBitmap ready; // threads that are not halted and not waiting
+    std::vector<MicroOp> program; // decoded programs of all threads, back to back
+    std::vector<int> programStart; // index of the first micro op of every thread in program
+    std::vector<int> programLength;
+    bool streamed; // the context streams its instructions, they are decoded as they are fetched
+    std::vector<MicroOp> fetched; // streamed contexts: the micro op every thread fetched last
+    TRACE_Process* tracer; // NULL if the simulation is not traced
+    std::vector<std::pair<uint32_t, int32_t> >* storeLog; // stores to publish to other cores, NULL on a single core
+    DataCache cache; // LOADs and STOREs take the image latencies while it is not enabled
+    MemoryQueue memory; // LOADs start at once while it is not enabled
+    int storeBuffer; // scoreboard mode: entries of the store buffer of every thread, 0 if the mode is off
+    std::vector<long long> regReadyAt; // scoreboard mode: tick in which every register of every thread is written
+    std::vector<long long> storeDone; // scoreboard mode: ring of the ticks the last stores of every thread drain
+    std::vector<long long> storeCount; // scoreboard mode: stores every thread made
+#ifdef SIM_STATS
+    core_stats coreStats;
+    std::vector<thread_stats> threadStats;
+#endif
+    void decodePrograms();
 public:
-    baseCore();
-    ~baseCore();
+    /**
+     * @param tids - threads of the image the core runs, NULL for all of them
+     */
+    baseCore(SIM_Context* ctx, const std::vector<int>* tids);
+    virtual ~baseCore();
     bool isOver();
-    void reduceHoldCounter();
-    void executeLine(Instruction* inst, int threadNum);
-    virtual void runSim() = 0;
+    bool canRun(int threadNum);
+    void holdThread(int threadNum, int latency);
+    void advanceTick(long long cyclesPassed = 1);
+    void skipIdleCycles();
+    void skipTo(long long readyTick);
+    const MicroOp& fetchLine(int line, int threadNum);
+    void executeLine(const MicroOp& uop, int threadNum);
+    void holdLoad(int threadNum, int latency);
+    void holdStore(int threadNum, int latency);
+    void loadPending(int threadNum, int reg, int latency);
+    void bufferStore(int threadNum, int latency);
+    void holdForOperands(int threadNum);
+    /**
+     * runs until all threads halt, or until a cycle starts at cycleLimit or later
+     */
+    virtual void runSim(double cycleLimit) = 0;
     virtual int getNextCycle(int currentThread) = 0;
     void getContext(tcontext* context, int threadNum);
     double getCPI();
+    double getCycles(){
+        return cycles;
+    }
+    double getInstructions(){
+        return instructionCounter;
+    }
+    double getThroughput(int threadNum);
+    double getFairness();
+    virtual bool setWeight(int threadNum, int weight){
+        (void)threadNum;
+        (void)weight;
+        return false;
+    }
+    int getStats(core_stats* stats);
+    int getThreadStats(int threadNum, thread_stats* stats);
+    void setTrace(TRACE_Process* process){
+        tracer = process;
+    }
+    void setStoreLog(std::vector<std::pair<uint32_t, int32_t> >* log){
+        storeLog = log;
+    }
+    bool setCache(const cache_config& config){
+        return cache.configure(config, numOfThreads);
+    }
+    bool hasCache(){
+        return cache.enabled();
+    }
+    /**
+     * @return the data cache accesses of a thread, NULL if the core has no cache
+     */
+    const cache_stats* getCacheStats(int threadNum){
+        return cache.enabled() ? &cache.getThreadStats(threadNum) : NULL;
+    }
+    /**
+     * @return the fewest cycles a LOAD or STORE takes
+     */
+    int minMemoryLatency(){
+        return cache.enabled() ? cache.minLatency() : min(loadLat, storeLat);
+    }
+    /**
+     * @param entries - entries of the store buffer of every thread, at least 1
+     * @return false if entries is out of range
+     */
+    bool setScoreboard(int entries){
+        if (entries < 1)
+            return false;
+        storeBuffer = entries;
+        regReadyAt.assign((size_t)numOfThreads * REGS_COUNT, 0);
+        storeDone.assign((size_t)numOfThreads * entries, 0);
+        storeCount.assign(numOfThreads, 0);
+        return true;
+    }
+    bool setMemory(const memory_config& config){
+        return memory.configure(config, numOfThreads);
+    }
+    bool hasMemory(){
+        return memory.enabled();
+    }
+    /**
+     * @return the memory requests of a thread, NULL if the core memory is not bounded
+     */
+    const memory_stats* getMemoryStats(int threadNum){
+        return memory.enabled() ? &memory.getThreadStats(threadNum) : NULL;
+    }
+    /**
+     * @return the cycles a LOAD or STORE of the given address takes, LOADs that reach the memory include the
+     *         time they queue for it
+     */
+    int memoryLatency(uint32_t addr, int threadNum, bool store){
+        bool hit = false;
+        int latency = store ? storeLat : loadLat;
+        if (cache.enabled()){
+            hit = cache.access(addr, threadNum, store);
+            latency = cache.latency(hit);
+        }
+        if (!store && !hit && memory.enabled())
+            latency = memory.issue(tick, latency, threadNum);
+        return latency;
+    }
+    /**
+     * adds a slice to the trace of the simulation, if it is traced
+     * @param threadNum - track of the slice, numOfThreads for the core track
+     */
+    void trace(int threadNum, trace_kind kind, double start, long long duration){
+        if (tracer != NULL)
+            TRACE_Event(tracer, threadNum, kind, (long long)start, duration);
+    }
 };
 
 
-baseCore::baseCore(): cycles(0), instructionCounter(0), _nop(false), _isIdle(false) {
-    numOfThreads = SIM_GetThreadsNum();
-    threads = new vector<ThreadData*>();
+baseCore::baseCore(SIM_Context* ctx, const std::vector<int>* tids): ctx(ctx), loadLat(SIM_CtxGetLoadLat(ctx)),
+                      storeLat(SIM_CtxGetStoreLat(ctx)), switchCycles(SIM_CtxGetSwitchCycles(ctx)),
+                      numOfThreads(tids ? (int)tids->size() : SIM_CtxGetThreadsNum(ctx)), threads(numOfThreads),
+                      cycles(0), instructionCounter(0), _nop(false), _isIdle(false), runningThread(0), tick(0),
+                      ready(numOfThreads), tracer(NULL), storeLog(NULL), storeBuffer(0) {
+    liveThreads = numOfThreads;
+    for (int i = 0; i < numOfThreads; i++)
+        threadIds.push_back(tids ? (*tids)[i] : i);
+#ifdef SIM_STATS
+    memset(&coreStats, 0, sizeof(coreStats));
+    thread_stats noStats = {0, 0, 0, 0};
+    threadStats.assign(numOfThreads, noStats);
+#endif
+    wakeUps.reserve(numOfThreads); // a thread waits on at most one operation at a time
     for (int i = 0; i < this->numOfThreads; i++){
-        threads->push_back(new ThreadData(i));
+        ready.set(i);
     }
+    decodePrograms();
 }
 
-baseCore::~baseCore(){
-    for (int i = 0; i < this->numOfThreads; i++){
-        ThreadData* temp = threads->at(i);
-        delete temp;
+/**
+ * decodes the programs of all threads once, so executing a line needs no copying or operand checks
+ */
+void baseCore::decodePrograms(){
+    Instruction inst;
+    programStart.resize(numOfThreads);
+    programLength.resize(numOfThreads);
+    streamed = SIM_CtxIsStreamed(ctx);
+    if (streamed){ // the programs are not in memory, fetchLine decodes them line by line
+        fetched.resize(numOfThreads);
+        for (int tid = 0; tid < numOfThreads; tid++)
+            programLength[tid] = SIM_CtxGetInstCount(ctx, threadIds[tid]);
+        return;
+    }
+    for (int tid = 0; tid < numOfThreads; tid++){
+        programStart[tid] = program.size();
+        programLength[tid] = SIM_CtxGetInstCount(ctx, threadIds[tid]);
+        for (int line = 0; line < programLength[tid]; line++){
+            SIM_CtxMemInstRead(ctx, line, &inst, threadIds[tid]);
+            program.push_back(decodeInstruction(&inst));
+        }
     }
 }
 
+baseCore::~baseCore(){
+}
+
 
 /**
  * @return true if all threads are on halt, false otherwise
  */
 bool baseCore::isOver(){
-    for (vector<ThreadData*>::iterator it = threads->begin(); it != threads->end(); it++){
-        if (!(*it)->isHalt)
-            return false;
-    }
-    return true;
+    return liveThreads == 0;
+}
+
+/**
+ * @param threadNum - thread to check
+ * @return true if the thread is not halted and done waiting, false otherwise
+ */
+bool baseCore::canRun(int threadNum){
+    return ready.test(threadNum);
 }
 
 /**
- * reduces all hold counters of threads by 1
+ * puts a thread on hold for the given latency, counted from the current tick
+ * @param threadNum - thread to hold
+ * @param latency - cycles until the thread may run again
  */
-void baseCore::reduceHoldCounter(){
-    for (vector<ThreadData*>::iterator it = threads->begin(); it != threads->end(); it++){
-        if ((*it)->cyclesOnHold > 0)
-            (*it)->cyclesOnHold --;
+void baseCore::holdThread(int threadNum, int latency){
+    threads.readyAt[threadNum] = tick + latency;
+    if (latency <= 0)
+        return;
+    ready.clear(threadNum);
+    wakeUps.push_back(make_pair(threads.readyAt[threadNum], threadNum));
+    push_heap(wakeUps.begin(), wakeUps.end(), greater<pair<long long, int> >());
+}
+
+/**
+ * advances the hold clock, every thread whose readyAt stamp is reached becomes free to run
+ * @param cyclesPassed - cycles that passed since the last advance
+ */
+void baseCore::advanceTick(long long cyclesPassed){
+    if (cyclesPassed <= 0)
+        return;
+    tick += cyclesPassed;
+    while (!wakeUps.empty() && wakeUps.front().first <= tick){ // wake up threads that are done waiting
+        ready.set(wakeUps.front().second);
+        pop_heap(wakeUps.begin(), wakeUps.end(), greater<pair<long long, int> >());
+        wakeUps.pop_back();
     }
 }
 
 /**
- * executes the next line of a given thread
- * @param inst - the instruction to be executed
- * @param threadNum - thread running
+ * jumps over idle cycles in which no thread can be woken up.
+ * every skipped cycle would only have counted itself and advanced the hold clock,
+ * so the simulation continues from the cycle in which the first thread is ready.
  */
-void baseCore::executeLine(Instruction* inst, int threadNum){
-    if (inst->opcode == CMD_HALT) {
-        threads->at(threadNum)->isHalt = true;
+void baseCore::skipIdleCycles(){
+    if (wakeUps.empty() || (int)wakeUps.size() < liveThreads) // some live thread is not waiting
         return;
+    skipTo(wakeUps.front().first);
+}
+
+/**
+ * jumps over the idle cycles until the given tick, in which no thread may run
+ */
+void baseCore::skipTo(long long readyTick){
+    long long skip = readyTick - tick;
+    trace(numOfThreads, TRACE_IDLE, cycles, skip);
+    cycles += skip;
+    STATS(coreStats.idleCycles += skip);
+    advanceTick(skip);
+}
+
+/**
+ * @param line - line to fetch
+ * @param threadNum - thread running
+ * @return the decoded instruction in the given line, a thread that runs past its program halts
+ */
+const MicroOp& baseCore::fetchLine(int line, int threadNum){
+    static const MicroOp haltOp = {UOP_HALT, 0, 0, 0, 0};
+    if (line >= programLength[threadNum])
+        return haltOp;
+    if (streamed){
+        Instruction inst;
+        SIM_CtxMemInstRead(ctx, line, &inst, threadIds[threadNum]);
+        fetched[threadNum] = decodeInstruction(&inst);
+        return fetched[threadNum];
     }
-    int* dstReg = &threads->at(threadNum)->context->reg[inst->dst_index];
-    int src1 = threads->at(threadNum)->context->reg[inst->src1_index];
-    int src2 = NULL;
-    if (inst->isSrc2Imm)
-        src2 = inst->src2_index_imm;
+    return program[programStart[threadNum] + line];
+}
+
+/**
+ * holds a thread for the whole latency of its LOAD
+ */
+void baseCore::holdLoad(int threadNum, int latency){
+    holdThread(threadNum, latency);
+    threads.heldOnLoad[threadNum] = true;
+    STATS(threadStats[threadNum].loadStallCycles += max(latency, 0));
+    trace(threadNum, TRACE_LOAD, cycles, latency);
+}
+
+/**
+ * holds a thread for the whole latency of its STORE
+ */
+void baseCore::holdStore(int threadNum, int latency){
+    holdThread(threadNum, latency);
+    threads.heldOnLoad[threadNum] = false;
+    STATS(threadStats[threadNum].storeStallCycles += max(latency, 0));
+    trace(threadNum, TRACE_STORE, cycles, latency);
+}
+
+/**
+ * scoreboard mode: the destination of a LOAD is written once its data returns, the thread goes on meanwhile
+ */
+void baseCore::loadPending(int threadNum, int reg, int latency){
+    regReadyAt[(size_t)threadNum * REGS_COUNT + reg] = tick + latency;
+    threads.loadDoneAt[threadNum] = tick + latency;
+}
+
+/**
+ * scoreboard mode: a STORE retires into the store buffer of its thread, which drains one store at a time,
+ * every store taking its latency from when the store before it drained
+ */
+void baseCore::bufferStore(int threadNum, int latency){
+    long long* ring = &storeDone[(size_t)threadNum * storeBuffer];
+    long long count = storeCount[threadNum]++;
+    long long previous = count ? ring[(count - 1) % storeBuffer] : 0;
+    ring[count % storeBuffer] = max(previous, tick) + max(latency, 0);
+}
+
+/**
+ * scoreboard mode: holds a thread until its next instruction may issue, once the registers it reads or writes
+ * are written and, for a STORE, once the store buffer of the thread has a free entry
+ * @param threadNum - thread that executed an instruction
+ */
+void baseCore::holdForOperands(int threadNum){
+    if (threads.isHalt[threadNum])
+        return;
+    const MicroOp& uop = fetchLine(threads.lastLine[threadNum] + 1, threadNum);
+    if (uop.kind == UOP_NOP || uop.kind == UOP_HALT) // no operands
+        return;
+    const long long* regReady = &regReadyAt[(size_t)threadNum * REGS_COUNT];
+    long long operandsAt = max(regReady[uop.dst], regReady[uop.src1]);
+    if (uop.kind == UOP_ADD_REG || uop.kind == UOP_SUB_REG || uop.kind == UOP_LOAD_REG || uop.kind == UOP_STORE_REG)
+        operandsAt = max(operandsAt, regReady[uop.src2]);
+    long long bufferAt = 0; // the oldest of the buffered stores drains by then
+    long long count = storeCount[threadNum];
+    if ((uop.kind == UOP_STORE_REG || uop.kind == UOP_STORE_IMM) && count >= storeBuffer)
+        bufferAt = storeDone[(size_t)threadNum * storeBuffer + count % storeBuffer];
+    if (max(operandsAt, bufferAt) <= tick)
+        return;
+    if (bufferAt > operandsAt)
+        holdStore(threadNum, (int)(bufferAt - tick));
     else
-        src2 = threads->at(threadNum)->context->reg[inst->src2_index_imm];
+        holdLoad(threadNum, (int)(operandsAt - tick));
+}
 
-    switch (inst->opcode) { //decide on the operation to run
-        case CMD_ADD:
-            *dstReg = src1 + src2;
+/**
+ * executes the next line of a given thread
+ * @param uop - the decoded instruction to be executed
+ * @param threadNum - thread running
+ */
+void baseCore::executeLine(const MicroOp& uop, int threadNum){
+    int* regs = threads.regs[threadNum].reg;
+    int32_t data;
+    uint32_t addr;
+    int latency;
+
+    switch (uop.kind) { //dense switch, compiled into a jump table over the handlers
+        case UOP_NOP:
             break;
-        case CMD_ADDI:
-            *dstReg = src1 + src2;
+        case UOP_ADD_REG:
+            regs[uop.dst] = regs[uop.src1] + regs[uop.src2];
             break;
-        case CMD_SUB:
-            *dstReg = src1 - src2;
+        case UOP_ADD_IMM:
+            regs[uop.dst] = regs[uop.src1] + uop.imm;
             break;
-        case CMD_SUBI:
-            *dstReg = src1 - src2;
+        case UOP_SUB_REG:
+            regs[uop.dst] = regs[uop.src1] - regs[uop.src2];
             break;
-        case CMD_STORE:
-            SIM_MemDataWrite((*dstReg + src2), src1);
-            threads->at(threadNum)->cyclesOnHold = SIM_GetStoreLat();
+        case UOP_SUB_IMM:
+            regs[uop.dst] = regs[uop.src1] - uop.imm;
             break;
-        case CMD_LOAD:
-            int32_t* data = new int32_t();
-            SIM_MemDataRead((src1+src2), data);
-            *dstReg = *data;
-            threads->at(threadNum)->cyclesOnHold = SIM_GetLoadLat();
+        case UOP_LOAD_REG:
+            addr = regs[uop.src1] + regs[uop.src2];
+            SIM_CtxMemDataRead(ctx, addr, &data);
+            regs[uop.dst] = data;
+            latency = memoryLatency(addr, threadNum, false);
+            if (storeBuffer)
+                loadPending(threadNum, uop.dst, latency);
+            else
+                holdLoad(threadNum, latency);
+            break;
+        case UOP_LOAD_IMM:
+            addr = regs[uop.src1] + uop.imm;
+            SIM_CtxMemDataRead(ctx, addr, &data);
+            regs[uop.dst] = data;
+            latency = memoryLatency(addr, threadNum, false);
+            if (storeBuffer)
+                loadPending(threadNum, uop.dst, latency);
+            else
+                holdLoad(threadNum, latency);
+            break;
+        case UOP_STORE_REG:
+            addr = regs[uop.dst] + regs[uop.src2];
+            SIM_CtxMemDataWrite(ctx, addr, regs[uop.src1]);
+            if (storeLog != NULL)
+                storeLog->push_back(make_pair(addr, regs[uop.src1]));
+            latency = memoryLatency(addr, threadNum, true);
+            if (storeBuffer)
+                bufferStore(threadNum, latency);
+            else
+                holdStore(threadNum, latency);
+            break;
+        case UOP_STORE_IMM:
+            addr = regs[uop.dst] + uop.imm;
+            SIM_CtxMemDataWrite(ctx, addr, regs[uop.src1]);
+            if (storeLog != NULL)
+                storeLog->push_back(make_pair(addr, regs[uop.src1]));
+            latency = memoryLatency(addr, threadNum, true);
+            if (storeBuffer)
+                bufferStore(threadNum, latency);
+            else
+                holdStore(threadNum, latency);
+            break;
+        case UOP_HALT:
+            threads.haltCycle[threadNum] = cycles;
+            STATS(threadStats[threadNum].haltCycle = cycles);
+            threads.isHalt[threadNum] = true;
+            ready.clear(threadNum);
+            liveThreads--;
             break;
     }
-
 }
 
 /**
@@ -140,7 +569,7 @@ void baseCore::executeLine(Instruction* inst, int threadNum){
  */
 void baseCore::getContext(tcontext* context, int threadNum){
     for (int i = 0; i < REGS_COUNT; i++){
-        context->reg[i] = threads->at(threadNum)->context->reg[i];
+        context->reg[i] = threads.regs[threadNum].reg[i];
     }
     return;
 }
@@ -152,15 +581,137 @@ double baseCore::getCPI(){
     return cycles/instructionCounter;
 }
 
+/**
+ * @param threadNum - thread to get
+ * @return instructions the thread executed over the cycles it took to halt
+ */
+double baseCore::getThroughput(int threadNum){
+    return (threads.lastLine[threadNum] + 1) / threads.haltCycle[threadNum];
+}
+
+/**
+ * @return Jain's fairness index over the throughput of the threads, every thread's instructions
+ *         over the cycles it took to halt: 1 if all progressed alike, down to 1/threads
+ */
+double baseCore::getFairness(){
+    double sum = 0, squares = 0;
+    for (int tid = 0; tid < numOfThreads; tid++){
+        double throughput = getThroughput(tid);
+        sum += throughput;
+        squares += throughput * throughput;
+    }
+    return sum * sum / (numOfThreads * squares);
+}
+
+/**
+ * @param stats - filled with the cycle accounting of the core
+ * @return 0 on success, -1 if the build does not collect stats
+ */
+int baseCore::getStats(core_stats* stats){
+#ifdef SIM_STATS
+    *stats = coreStats;
+    stats->cycles = cycles;
+    stats->instructions = instructionCounter;
+    return 0;
+#else
+    (void)stats;
+    return -1;
+#endif
+}
+
+/**
+ * @param threadNum - thread to get
+ * @param stats - filled with the cycle accounting of the thread
+ * @return 0 on success, -1 if the build does not collect stats
+ */
+int baseCore::getThreadStats(int threadNum, thread_stats* stats){
+#ifdef SIM_STATS
+    *stats = threadStats[threadNum];
+    return 0;
+#else
+    (void)threadNum;
+    (void)stats;
+    return -1;
+#endif
+}
+
 /**
  * class of a Blocked Multi-Threaded core
  */
 class BlockedMt: public baseCore{
+    core_switch switchPolicy;
+    int threshold;
+    bool _waiting; // the policy waits for the held thread instead of switching
+    int switchPenalty; // cycles of the next switch
+    std::vector<int> inFlight; // CORE_SWITCH_FLUSH: flush cost of the last instructions issued, a ring of O
+    int inFlightCount; // instructions issued since the last switch
+    int inFlightCost; // flush cost of the instructions in the ring that are in flight
+    bool waitsOut(int threadNum);
+    void issued(const MicroOp& uop);
+    int flushCost();
 public:
+    BlockedMt(SIM_Context* ctx, const std::vector<int>* tids): baseCore(ctx, tids), switchPolicy(CORE_SWITCH_ON_HOLD),
+        threshold(0), _waiting(false), switchPenalty(switchCycles), inFlightCount(0), inFlightCost(0){}
+    bool setSwitchPolicy(core_switch policy, int switchThreshold);
     int getNextCycle(int currentThread) override;
-    void runSim() override;
+    void runSim(double cycleLimit) override;
 };
 
+/**
+ * @param policy - when to switch away from a held thread
+ * @param switchThreshold - hold cycles CORE_SWITCH_THRESHOLD waits out
+ * @return false if either is out of range
+ */
+bool BlockedMt::setSwitchPolicy(core_switch policy, int switchThreshold){
+    if (policy < CORE_SWITCH_ON_HOLD || policy >= CORE_SWITCH_COUNT || switchThreshold < 0)
+        return false;
+    switchPolicy = policy;
+    threshold = switchThreshold;
+    inFlight.assign(policy == CORE_SWITCH_FLUSH ? max(switchCycles, 0) : 0, 0);
+    return true;
+}
+
+/**
+ * @return true if the policy waits for a held thread to run again rather than switching away from it
+ */
+bool BlockedMt::waitsOut(int threadNum){
+    if (threads.isHalt[threadNum])
+        return false;
+    if (switchPolicy == CORE_SWITCH_THRESHOLD)
+        return threads.readyAt[threadNum] - tick <= threshold;
+    if (switchPolicy == CORE_SWITCH_ON_LOAD)
+        return !threads.heldOnLoad[threadNum];
+    return false;
+}
+
+/**
+ * CORE_SWITCH_FLUSH: puts an instruction in flight, the one issued O instructions before it leaves
+ */
+void BlockedMt::issued(const MicroOp& uop){
+    if (inFlight.empty())
+        return;
+    int cost = (uop.kind == UOP_NOP || uop.kind == UOP_HALT) ? 0 :
+               (uop.kind >= UOP_LOAD_REG && uop.kind <= UOP_STORE_IMM) ? 2 : 1;
+    int slot = inFlightCount % (int)inFlight.size();
+    if (inFlightCount >= (int)inFlight.size())
+        inFlightCost -= inFlight[slot];
+    inFlight[slot] = cost;
+    inFlightCost += cost;
+    inFlightCount++;
+}
+
+/**
+ * @return the cycles a switch takes, flushing the instructions in flight under CORE_SWITCH_FLUSH
+ */
+int BlockedMt::flushCost(){
+    if (switchPolicy != CORE_SWITCH_FLUSH || inFlight.empty())
+        return switchCycles;
+    int cost = max(inFlightCost, 1);
+    inFlightCount = 0;
+    inFlightCost = 0;
+    return cost;
+}
+
 /**
  * find thread for next cycle under blockedMT rules
  * @param currentThread
@@ -169,15 +720,15 @@ public:
 int BlockedMt::getNextCycle(int currentThread){
     if (isOver()) // return if simulation is done
         return currentThread;
-    if (threads->at(currentThread)->isHalt || threads->at(currentThread)->cyclesOnHold > 0){ // if thread cannot run
+    if (!canRun(currentThread)){ // if thread cannot run
         _nop = true;
-        for (int i = currentThread; i < numOfThreads + currentThread; i++) { // iterated over all threads cyclically
-            int tempThread = i % numOfThreads;
-            if (threads->at(tempThread)->isHalt || threads->at(tempThread)->cyclesOnHold >0) { // thread cannot run
-                continue;
-            }
+        _waiting = waitsOut(currentThread);
+        // round robin over the threads that can run
+        int nextThread = _waiting ? -1 : ready.findNextCyclic(currentThread);
+        if (nextThread >= 0) {
             _isIdle = false; // found a thread that can run
-            return tempThread;
+            switchPenalty = flushCost();
+            return nextThread;
         }
         _isIdle = true; // no thread can run
         return currentThread;
@@ -191,42 +742,227 @@ int BlockedMt::getNextCycle(int currentThread){
 
 /**
  * run simulation under blockedMT rules
- * @param currentThread
- * @return next thread to eun
+ * @param cycleLimit - no cycle starts at or after it
  */
-void BlockedMt::runSim(){
-    Instruction* inst = new Instruction();
-
+void BlockedMt::runSim(double cycleLimit){
     int line;
-    int threadNum = 0;
+    int threadNum = runningThread;
 
-    while(!isOver()){ // run until simulation is over
+    while(!isOver() && cycles < cycleLimit){ // run until simulation is over
+        if (_nop && _isIdle){ // no thread can run, or the policy waits for the held one: jump to the wake up
+            if (_waiting)
+                skipTo(threads.readyAt[threadNum]);
+            else
+                skipIdleCycles();
+            if (cycles >= cycleLimit) // the wake up is past the limit, so is the instruction after it
+                break;
+        }
         cycles++;
         if (_nop){ // check if there is an operation to be run
             if (!_isIdle){ // no operation because of context switch
-                cycles += SIM_GetSwitchCycles() -1;
-                for (int i = 0; i < SIM_GetSwitchCycles() -1; i++) { //simulate context switch overhead
-                    reduceHoldCounter();
-                }
+                cycles += switchPenalty -1;
+                advanceTick(switchPenalty -1); //simulate context switch overhead
+                STATS(coreStats.switchCycles += switchPenalty);
+                trace(threadNum, TRACE_SWITCH, cycles - switchPenalty, switchPenalty);
+            }
+            else {
+                STATS(coreStats.idleCycles++);
+                trace(numOfThreads, TRACE_IDLE, cycles - 1, 1);
             }
         }
         else { // run current operation
-            line = threads->at(threadNum)->lastLine + 1;
-            SIM_MemInstRead (line, inst, threadNum);
-            executeLine(inst, threadNum);
-            threads->at(threadNum)->lastLine  = line;
+            trace(threadNum, TRACE_EXEC, cycles - 1, 1);
+            line = threads.lastLine[threadNum] + 1;
+            const MicroOp& uop = fetchLine(line, threadNum);
+            executeLine(uop, threadNum);
+            issued(uop);
+            threads.lastLine[threadNum] = line;
+            if (storeBuffer)
+                holdForOperands(threadNum);
             instructionCounter ++;
+            STATS(coreStats.execCycles++);
+            STATS(threadStats[threadNum].instructions++);
         }
         threadNum = getNextCycle(threadNum); // find thread for next cycle
-        reduceHoldCounter(); // mark cycle over of all waiting threads
+        advanceTick(); // mark cycle over of all waiting threads
     }
-    delete inst;
+    runningThread = threadNum;
+    if (tracer != NULL)
+        TRACE_Flush(tracer);
 }
 
+/*
+ * Thread selection policies of the fine-grained core. A policy is a template argument of the core rather than
+ * an interface, so picking a thread every cycle is an inlined call. Every policy provides
+ *   int pick(int currentThread) - the thread for the next cycle, -1 if no thread can run
+ *   void executed(int threadNum, const MicroOp& uop) - called after a thread executed an instruction
+ */
+
+/**
+ * strict round robin over the ready threads, starting after the current one
+ */
+class RoundRobinPolicy{
+    const ThreadBitmap& ready;
+    int numOfThreads;
+public:
+    RoundRobinPolicy(const ThreadBitmap& ready, const ThreadStore& threads, const long long& tick):
+        ready(ready), numOfThreads(threads.count){
+        (void)tick;
+    }
+    int pick(int currentThread){
+        return ready.findNextCyclic((currentThread + 1) % numOfThreads);
+    }
+    void executed(int threadNum, const MicroOp& uop){
+        (void)threadNum;
+        (void)uop;
+    }
+};
+
+/**
+ * base of the policies that pick the ready thread with the smallest key, ties go to the thread that comes
+ * first in round robin order. costs a scan over the ready threads every cycle.
+ */
+class MinKeyPolicy{
+protected:
+    const ThreadBitmap& ready;
+    const ThreadStore& threads;
+    int numOfThreads;
+    MinKeyPolicy(const ThreadBitmap& ready, const ThreadStore& threads): ready(ready), threads(threads),
+                                                                         numOfThreads(threads.count){}
+    /**
+     * @param key - key of a thread, called with every ready thread
+     * @return the ready thread with the smallest key, -1 if no thread is ready
+     */
+    template <class Key>
+    int pickMin(int currentThread, Key key) const{
+        int start = (currentThread + 1) % numOfThreads;
+        int best = -1;
+        long long bestKey = 0;
+        for (int pass = 0; pass < 2; pass++){ // from start to the end, then from 0 up to start
+            int first = pass ? 0 : start;
+            int last = pass ? start : numOfThreads;
+            for (int tid = ready.findNext(first); tid >= 0 && tid < last; tid = ready.findNext(tid + 1)){
+                long long tidKey = key(tid);
+                if (best < 0 || tidKey < bestKey){
+                    best = tid;
+                    bestKey = tidKey;
+                }
+            }
+        }
+        return best;
+    }
+};
+
+/**
+ * ICOUNT: the ready thread with the fewest instructions executed so far plus LOADs still outstanding, favouring
+ * the threads that progressed least. a thread is not ready while it waits on a memory operation, except in
+ * scoreboard mode, where it goes on while its LOADs are outstanding and every one of them counts against it.
+ * the next instruction waits for the register a LOAD writes, so a thread has at most REGS_COUNT outstanding
+ */
+class ICountPolicy: public MinKeyPolicy{
+    const long long& tick;
+    std::vector<long long> executedCount;
+    std::vector<long long> loadsDone; // ticks the outstanding LOADs of every thread return, REGS_COUNT per thread
+    std::vector<int> loadsCount; // outstanding LOADs of every thread
+    /**
+     * @return the LOADs of a thread whose data has not returned yet, forgetting those that returned
+     */
+    int outstanding(int tid){
+        long long* done = &loadsDone[(size_t)tid * REGS_COUNT];
+        int& count = loadsCount[tid];
+        for (int i = 0; i < count;)
+            if (done[i] <= tick)
+                done[i] = done[--count];
+            else
+                i++;
+        return count;
+    }
+public:
+    ICountPolicy(const ThreadBitmap& ready, const ThreadStore& threads, const long long& tick):
+        MinKeyPolicy(ready, threads), tick(tick), executedCount(threads.count, 0),
+        loadsDone((size_t)threads.count * REGS_COUNT, 0), loadsCount(threads.count, 0){}
+    int pick(int currentThread){
+        return pickMin(currentThread, [this](int tid){ return executedCount[tid] + outstanding(tid); });
+    }
+    void executed(int threadNum, const MicroOp& uop){
+        executedCount[threadNum]++;
+        bool load = (uop.kind == UOP_LOAD_REG || uop.kind == UOP_LOAD_IMM);
+        if (load && threads.loadDoneAt[threadNum] > tick && outstanding(threadNum) < REGS_COUNT)
+            loadsDone[(size_t)threadNum * REGS_COUNT + loadsCount[threadNum]++] = threads.loadDoneAt[threadNum];
+    }
+};
+
+/**
+ * oldest ready first: the thread that has been ready the longest, since it woke up or last executed
+ */
+class OldestReadyPolicy: public MinKeyPolicy{
+    const long long& tick;
+    std::vector<long long> lastRun; // tick in which the thread last executed
+public:
+    OldestReadyPolicy(const ThreadBitmap& ready, const ThreadStore& threads, const long long& tick):
+        MinKeyPolicy(ready, threads), tick(tick), lastRun(threads.count, -1){}
+    int pick(int currentThread){
+        return pickMin(currentThread, [this](int tid){ return max(this->threads.readyAt[tid], lastRun[tid] + 1); });
+    }
+    void executed(int threadNum, const MicroOp& uop){
+        (void)uop;
+        lastRun[threadNum] = tick;
+    }
+};
+
+static const long long strideUnit = CORE_MAX_THREAD_WEIGHT; // stride of a thread of weight 1, the heaviest gets 1
+
+/**
+ * weighted priority by stride scheduling: every thread advances its pass by the inverse of its weight when it
+ * executes and the ready thread with the smallest pass runs, so ready threads share the cycles by weight
+ */
+class WeightedPolicy: public MinKeyPolicy{
+    std::vector<long long> pass;
+    std::vector<long long> stride;
+public:
+    WeightedPolicy(const ThreadBitmap& ready, const ThreadStore& threads, const long long& tick):
+        MinKeyPolicy(ready, threads), pass(threads.count, 0), stride(threads.count, strideUnit){
+        (void)tick;
+    }
+    bool setWeight(int threadNum, int weight){
+        if (weight < 1 || weight > CORE_MAX_THREAD_WEIGHT) // heavier threads would not advance their pass
+            return false;
+        stride[threadNum] = strideUnit / weight;
+        return true;
+    }
+    int pick(int currentThread){
+        return pickMin(currentThread, [this](int tid){ return pass[tid]; });
+    }
+    void executed(int threadNum, const MicroOp& uop){
+        (void)uop;
+        pass[threadNum] += stride[threadNum];
+    }
+};
+
+/**
+ * class of a Fine-grained Multi-Threaded core, picking the thread of every cycle by a selection policy
+ */
+template <class Policy>
 class FinegrainedMT: public baseCore{
+    Policy policy;
+
+    template <class P>
+    static bool applyWeight(P& p, int threadNum, int weight){
+        (void)p;
+        (void)threadNum;
+        (void)weight;
+        return false;
+    }
+    static bool applyWeight(WeightedPolicy& p, int threadNum, int weight){
+        return p.setWeight(threadNum, weight);
+    }
 public:
+    FinegrainedMT(SIM_Context* ctx, const std::vector<int>* tids): baseCore(ctx, tids), policy(ready, threads, tick){}
     int getNextCycle(int currentThread) override;
-    void runSim() override;
+    void runSim(double cycleLimit) override;
+    bool setWeight(int threadNum, int weight) override{
+        return applyWeight(policy, threadNum, weight);
+    }
 };
 
 /**
@@ -234,76 +970,584 @@ public:
  * @param currentThread
  * @return next thread to eun
  */
-int FinegrainedMT::getNextCycle(int currentThread){
+template <class Policy>
+int FinegrainedMT<Policy>::getNextCycle(int currentThread){
     if (isOver()) // return if simulation is done
         return currentThread;
-    for (int i = currentThread + 1; i < numOfThreads + (currentThread + 1); i++) { // iterated over all threads cyclically
-            int tempThread = i % numOfThreads;
-            if (threads->at(tempThread)->isHalt || threads->at(tempThread)->cyclesOnHold >0) { // thread cannot run
-                continue;
-            }
-            _isIdle = false; // found a thread that can run
-            return tempThread;
-        }
+    int nextThread = policy.pick(currentThread);
+    if (nextThread >= 0) {
+        _isIdle = false; // found a thread that can run
+        return nextThread;
+    }
     _isIdle = true; // no thread can run
     return currentThread;
 }
 
 /**
  * run simulation under FinegrainedMT rules
- * @param currentThread
- * @return next thread to eun
+ * @param cycleLimit - no cycle starts at or after it
  */
-void FinegrainedMT::runSim(){
-    Instruction* inst = new Instruction();
-
+template <class Policy>
+void FinegrainedMT<Policy>::runSim(double cycleLimit){
     int line;
-    int threadNum = 0;
+    int threadNum = runningThread;
 
-    while(!isOver()){
+    while(!isOver() && cycles < cycleLimit){
+        if (_isIdle){ // no thread can run, jump to the next wake up
+            skipIdleCycles();
+            if (cycles >= cycleLimit) // the wake up is past the limit, so is the instruction after it
+                break;
+        }
         cycles++;
         if (!_isIdle){
-            line = threads->at(threadNum)->lastLine + 1;
-            SIM_MemInstRead (line, inst, threadNum);
-            executeLine(inst, threadNum);
-            threads->at(threadNum)->lastLine  = line;
+            trace(threadNum, TRACE_EXEC, cycles - 1, 1);
+            line = threads.lastLine[threadNum] + 1;
+            const MicroOp& uop = fetchLine(line, threadNum);
+            executeLine(uop, threadNum);
+            policy.executed(threadNum, uop);
+            threads.lastLine[threadNum] = line;
+            if (storeBuffer)
+                holdForOperands(threadNum);
             instructionCounter ++;
+            STATS(coreStats.execCycles++);
+            STATS(threadStats[threadNum].instructions++);
+        }
+        else {
+            STATS(coreStats.idleCycles++);
+            trace(numOfThreads, TRACE_IDLE, cycles - 1, 1);
         }
         threadNum = getNextCycle(threadNum);
-        reduceHoldCounter();
+        advanceTick();
     }
-    delete inst;
+    runningThread = threadNum;
+    if (tracer != NULL)
+        TRACE_Flush(tracer);
 }
 
-baseCore* core;
+/**
+ * class of a Simultaneous Multi-Threaded core: every cycle it issues the next instruction of up to width
+ * ready threads, of which at most memPorts may be LOADs or STOREs. threads are picked round robin from the
+ * one after the last thread that issued, a thread whose memory operation finds no free port waits for the
+ * next cycle without taking an issue slot. with a width of 1 it schedules like FinegrainedMT.
+ */
+class SMTCore: public baseCore{
+    int width;
+    int memPorts;
+    std::vector<int> issueThreads; // threads that issue in the next cycle, in issue order
+    std::vector<MicroOp> issueOps; // the instruction every one of them issues
+    bool started; // the threads of the first cycle were picked
+    static bool isMemory(const MicroOp& uop){
+        return uop.kind >= UOP_LOAD_REG && uop.kind <= UOP_STORE_IMM;
+    }
+public:
+    SMTCore(SIM_Context* ctx, const std::vector<int>* tids): baseCore(ctx, tids), started(false){
+        setIssue(CORE_SMT_DEFAULT_WIDTH, CORE_SMT_DEFAULT_MEM_PORTS);
+    }
+    bool setIssue(int issueWidth, int ports);
+    int getNextCycle(int currentThread) override;
+    void runSim(double cycleLimit) override;
+};
+
+/**
+ * @param issueWidth - instructions issued per cycle, at least 1
+ * @param ports - LOADs and STOREs issued per cycle, at least 1
+ * @return false if either is out of range
+ */
+bool SMTCore::setIssue(int issueWidth, int ports){
+    if (issueWidth < 1 || ports < 1)
+        return false;
+    width = issueWidth;
+    memPorts = ports;
+    issueThreads.reserve(width); // so that runs do not allocate
+    issueOps.reserve(width);
+    return true;
+}
+
+/**
+ * picks the threads that issue in the next cycle under SMT rules
+ * @param currentThread - the last thread that issued, the search starts after it
+ * @return the last thread picked, currentThread if no thread can run
+ */
+int SMTCore::getNextCycle(int currentThread){
+    issueThreads.clear();
+    issueOps.clear();
+    _isIdle = true;
+    if (isOver())
+        return currentThread;
+    int start = (currentThread + 1) % numOfThreads;
+    int ports = memPorts;
+    int lastDistance = -1;
+    for (int from = start; (int)issueThreads.size() < width; ){
+        int nextThread = ready.findNextCyclic(from); // round robin over the threads that can run
+        if (nextThread < 0)
+            break;
+        int distance = (nextThread - start + numOfThreads) % numOfThreads;
+        if (distance <= lastDistance) // went around all threads
+            break;
+        lastDistance = distance;
+        from = (nextThread + 1) % numOfThreads;
+        const MicroOp& uop = fetchLine(threads.lastLine[nextThread] + 1, nextThread);
+        if (isMemory(uop)){
+            if (ports == 0) // all memory ports are taken this cycle
+                continue;
+            ports--;
+        }
+        issueThreads.push_back(nextThread);
+        issueOps.push_back(uop);
+    }
+    if (issueThreads.empty())
+        return currentThread;
+    _isIdle = false;
+    return issueThreads.back();
+}
+
+/**
+ * run simulation under SMT rules
+ * @param cycleLimit - no cycle starts at or after it
+ */
+void SMTCore::runSim(double cycleLimit){
+    if (!started){
+        runningThread = getNextCycle(numOfThreads - 1);
+        started = true;
+    }
+    int threadNum = runningThread;
+
+    while(!isOver() && cycles < cycleLimit){
+        if (_isIdle){ // no thread can run, jump to the next wake up
+            skipIdleCycles();
+            if (cycles >= cycleLimit) // the wake up is past the limit, so is the instruction after it
+                break;
+        }
+        cycles++;
+        if (!_isIdle){
+            for (size_t i = 0; i < issueThreads.size(); i++){
+                int tid = issueThreads[i];
+                trace(tid, TRACE_EXEC, cycles - 1, 1);
+                executeLine(issueOps[i], tid);
+                threads.lastLine[tid]++;
+                if (storeBuffer)
+                    holdForOperands(tid);
+                instructionCounter ++;
+                STATS(threadStats[tid].instructions++);
+            }
+            STATS(coreStats.execCycles++);
+        }
+        else {
+            STATS(coreStats.idleCycles++);
+            trace(numOfThreads, TRACE_IDLE, cycles - 1, 1);
+        }
+        threadNum = getNextCycle(threadNum);
+        advanceTick();
+    }
+    runningThread = threadNum;
+    if (tracer != NULL)
+        TRACE_Flush(tracer);
+}
+
+/**
+ * the cores of a multi-core run meet here after every epoch
+ */
+class EpochBarrier{
+    std::mutex lock;
+    std::condition_variable passed;
+    int count;
+    int waiting;
+    long long generation; // number of times all cores met
+public:
+    explicit EpochBarrier(int count): count(count), waiting(0), generation(0){}
+    void wait(){
+        std::unique_lock<std::mutex> guard(lock);
+        long long arrived = generation;
+        if (++waiting == count){
+            waiting = 0;
+            generation++;
+            passed.notify_all();
+            return;
+        }
+        while (generation == arrived)
+            passed.wait(guard);
+    }
+};
+
+typedef std::vector<std::pair<uint32_t, int32_t> > StoreLog;
+
+/*
+ * A simulation runs a core per core of the image, see SIM_CtxGetCoresNum. A single core runs straight over
+ * the context. Several cores run on host threads of their own over the same data memory, in epochs of
+ * min(L, S) cycles, or of the data cache latencies if they have a cache, after which they meet at a barrier.
+ * Within an epoch every core sees the memory as it was when the epoch started, plus its own stores. At the
+ * barrier the stores of all cores are published in core order, so a word several cores wrote keeps the value
+ * of the last of them. An epoch is no longer than a store takes, so a store reaches the other cores no later
+ * than it completes, and the result does not depend on how the host schedules the cores. Every core keeps its
+ * view in a snapshot of the context, the first core in the context itself.
+ */
+struct _core_sim{
+    std::vector<baseCore*> cores;
+    std::vector<SIM_Context*> memories; // data memory every core sees
+    std::vector<StoreLog> stores; // stores every core made in the current epoch
+    std::vector<int> threadCore; // core of every thread of the image
+    std::vector<int> coreThread; // index of every thread of the image within its core
+    std::vector<std::thread> hosts; // host threads of the cores after the first while they run
+};
+
+/**
+ * @param tids - threads of the image the core runs, NULL for all of them
+ * @return a core of the given model, NULL if there is no such model or policy
+ */
+static baseCore* newCore(SIM_Context* ctx, core_model model, core_policy policy, const std::vector<int>* tids){
+    if (model == CORE_MODEL_BLOCKED)
+        return new BlockedMt(ctx, tids);
+    if (model == CORE_MODEL_SMT)
+        return new SMTCore(ctx, tids);
+    if (model != CORE_MODEL_FINEGRAINED)
+        return NULL;
+    switch (policy) { // every policy is its own instance of the core, so the cycle loop never calls through a pointer
+        case CORE_POLICY_ROUND_ROBIN:
+            return new FinegrainedMT<RoundRobinPolicy>(ctx, tids);
+        case CORE_POLICY_ICOUNT:
+            return new FinegrainedMT<ICountPolicy>(ctx, tids);
+        case CORE_POLICY_OLDEST_READY:
+            return new FinegrainedMT<OldestReadyPolicy>(ctx, tids);
+        case CORE_POLICY_WEIGHTED:
+            return new FinegrainedMT<WeightedPolicy>(ctx, tids);
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * creates a simulation with a core of the given model per core of the image
+ * @return the simulation, NULL on failure
+ */
+static CORE_Sim* createSim(SIM_Context* ctx, core_model model, core_policy policy){
+    if (ctx == NULL)
+        return NULL;
+    int numCores = SIM_CtxGetCoresNum(ctx);
+    CORE_Sim* sim = new CORE_Sim();
+    std::vector<std::vector<int> > tids(numCores);
+    for (int tid = 0; tid < SIM_CtxGetThreadsNum(ctx); tid++){
+        int coreNum = (numCores == 1) ? 0 : SIM_CtxGetThreadCore(ctx, tid);
+        sim->threadCore.push_back(coreNum);
+        sim->coreThread.push_back(tids[coreNum].size());
+        tids[coreNum].push_back(tid);
+    }
+    sim->stores.resize(numCores > 1 ? numCores : 0); // never resized again, the cores point into it
+    for (int coreNum = 0; coreNum < numCores; coreNum++){
+        SIM_Context* memory = coreNum ? SIM_CtxSnapshot(ctx) : ctx;
+        const std::vector<int>* coreTids = (numCores > 1) ? &tids[coreNum] : NULL;
+        baseCore* newcore = (memory == NULL) ? NULL : newCore(memory, model, policy, coreTids);
+        if (newcore == NULL){
+            if (coreNum)
+                SIM_CtxFree(memory);
+            CORE_Destroy(sim);
+            return NULL;
+        }
+        sim->memories.push_back(memory);
+        sim->cores.push_back(newcore);
+        if (numCores > 1){
+            int insts = 0; // programs run straight through, so the core stores at most once per instruction
+            for (size_t k = 0; k < tids[coreNum].size(); k++)
+                insts += SIM_CtxGetInstCount(ctx, tids[coreNum][k]);
+            sim->stores[coreNum].reserve(insts); // so that runs do not allocate
+            newcore->setStoreLog(&sim->stores[coreNum]);
+        }
+    }
+    sim->hosts.reserve(numCores - 1);
+    return sim;
+}
+
+/**
+ * runs one core of a multi-core simulation in epochs, until all cores are over
+ * @param coreNum - core to run
+ * @param epoch - cycles of an epoch
+ */
+static void runCore(CORE_Sim* sim, int coreNum, EpochBarrier& barrier, double epoch){
+    baseCore* own = sim->cores[coreNum];
+    double limit = epoch;
+    while (true){
+        own->runSim(limit);
+        barrier.wait(); // all cores ran the epoch
+        for (size_t k = 0; k < sim->stores.size(); k++){
+            const StoreLog& log = sim->stores[k];
+            for (size_t i = 0; i < log.size(); i++)
+                SIM_CtxMemDataWrite(sim->memories[coreNum], log[i].first, log[i].second);
+        }
+        double first = -1; // earliest cycle a live core continues from, every core computes the same
+        for (size_t k = 0; k < sim->cores.size(); k++){
+            if (!sim->cores[k]->isOver() && (first < 0 || sim->cores[k]->getCycles() < first))
+                first = sim->cores[k]->getCycles();
+        }
+        barrier.wait(); // all cores published the epoch's stores
+        sim->stores[coreNum].clear();
+        if (first < 0)
+            return;
+        limit = first + epoch; // epochs in which no core would run are skipped
+    }
+}
+
+CORE_Sim* CORE_Create(SIM_Context* ctx, core_model model){
+    return createSim(ctx, model, CORE_POLICY_ROUND_ROBIN);
+}
+
+CORE_Sim* CORE_CreateFinegrained(SIM_Context* ctx, core_policy policy){
+    return createSim(ctx, CORE_MODEL_FINEGRAINED, policy);
+}
+
+int CORE_SetSwitchPolicy(CORE_Sim* sim, core_switch policy, int threshold){
+    for (size_t k = 0; k < sim->cores.size(); k++){
+        BlockedMt* blocked = dynamic_cast<BlockedMt*>(sim->cores[k]);
+        if (blocked == NULL || !blocked->setSwitchPolicy(policy, threshold))
+            return -1;
+    }
+    return 0;
+}
+
+const char* CORE_SwitchName(core_switch policy){
+    switch (policy) {
+        case CORE_SWITCH_ON_HOLD: return "on-hold";
+        case CORE_SWITCH_THRESHOLD: return "threshold";
+        case CORE_SWITCH_ON_LOAD: return "on-load";
+        case CORE_SWITCH_FLUSH: return "flush";
+        default: return NULL;
+    }
+}
+
+const char* CORE_PolicyName(core_policy policy){
+    switch (policy) {
+        case CORE_POLICY_ROUND_ROBIN: return "round-robin";
+        case CORE_POLICY_ICOUNT: return "icount";
+        case CORE_POLICY_OLDEST_READY: return "oldest-ready";
+        case CORE_POLICY_WEIGHTED: return "weighted";
+        default: return NULL;
+    }
+}
+
+int CORE_SetThreadWeight(CORE_Sim* sim, int threadid, int weight){
+    if (threadid < 0 || threadid >= (int)sim->threadCore.size())
+        return -1;
+    return sim->cores[sim->threadCore[threadid]]->setWeight(sim->coreThread[threadid], weight) ? 0 : -1;
+}
+
+void CORE_Run(CORE_Sim* sim){
+    if (sim->cores.size() == 1){
+        sim->cores[0]->runSim(numeric_limits<double>::infinity());
+        return;
+    }
+    double epoch = max(1, sim->cores[0]->minMemoryLatency());
+    EpochBarrier barrier((int)sim->cores.size());
+    for (size_t coreNum = 1; coreNum < sim->cores.size(); coreNum++)
+        sim->hosts.push_back(thread(runCore, sim, (int)coreNum, std::ref(barrier), epoch));
+    runCore(sim, 0, barrier, epoch);
+    for (size_t h = 0; h < sim->hosts.size(); h++)
+        sim->hosts[h].join();
+    sim->hosts.clear();
+}
+
+void CORE_GetCTX(CORE_Sim* sim, tcontext* context, int threadid){
+    sim->cores[sim->threadCore[threadid]]->getContext((context+threadid), sim->coreThread[threadid]);
+}
+
+double CORE_GetCPI(CORE_Sim* sim){
+    double cycles = 0, instructions = 0; // the cores run side by side, the run takes as long as the longest
+    for (size_t k = 0; k < sim->cores.size(); k++){
+        cycles = max(cycles, sim->cores[k]->getCycles());
+        instructions += sim->cores[k]->getInstructions();
+    }
+    return cycles/instructions;
+}
+
+int CORE_GetCoresNum(CORE_Sim* sim){
+    return (int)sim->cores.size();
+}
+
+double CORE_GetCoreCPI(CORE_Sim* sim, int coreNum){
+    return sim->cores[coreNum]->getCPI();
+}
+
+double CORE_GetFairness(CORE_Sim* sim){
+    int numOfThreads = (int)sim->threadCore.size();
+    double sum = 0, squares = 0;
+    for (int tid = 0; tid < numOfThreads; tid++){
+        double throughput = sim->cores[sim->threadCore[tid]]->getThroughput(sim->coreThread[tid]);
+        sum += throughput;
+        squares += throughput * throughput;
+    }
+    return sum * sum / (numOfThreads * squares);
+}
+
+int CORE_GetStats(CORE_Sim* sim, core_stats* stats){
+    memset(stats, 0, sizeof(*stats));
+    double coreCycles = 0;
+    for (size_t k = 0; k < sim->cores.size(); k++){
+        core_stats coreStats;
+        if (sim->cores[k]->getStats(&coreStats) != 0)
+            return -1;
+        stats->cycles = max(stats->cycles, coreStats.cycles); // as in CORE_GetCPI
+        coreCycles += coreStats.cycles;
+        stats->instructions += coreStats.instructions;
+        stats->execCycles += coreStats.execCycles;
+        stats->switchCycles += coreStats.switchCycles;
+        stats->idleCycles += coreStats.idleCycles;
+    }
+    stats->idleCycles += stats->cycles * sim->cores.size() - coreCycles; // cores that halted wait for the longest
+    return 0;
+}
+
+int CORE_GetThreadStats(CORE_Sim* sim, int threadid, thread_stats* stats){
+    return sim->cores[sim->threadCore[threadid]]->getThreadStats(sim->coreThread[threadid], stats);
+}
+
+int CORE_SetIssue(CORE_Sim* sim, int width, int memPorts){
+    for (size_t k = 0; k < sim->cores.size(); k++){
+        SMTCore* smt = dynamic_cast<SMTCore*>(sim->cores[k]);
+        if (smt == NULL || !smt->setIssue(width, memPorts))
+            return -1;
+    }
+    return 0;
+}
+
+int CORE_SetCache(CORE_Sim* sim, const cache_config* config){
+    for (size_t k = 0; k < sim->cores.size(); k++)
+        if (!sim->cores[k]->setCache(*config))
+            return -1;
+    return 0;
+}
+
+/**
+ * adds the data cache accesses of a thread to a sum
+ */
+static void addCacheStats(cache_stats* sum, const cache_stats& stats){
+    sum->loads += stats.loads;
+    sum->loadHits += stats.loadHits;
+    sum->stores += stats.stores;
+    sum->storeHits += stats.storeHits;
+}
+
+int CORE_GetCacheStats(CORE_Sim* sim, cache_stats* stats){
+    memset(stats, 0, sizeof(*stats));
+    if (!sim->cores[0]->hasCache())
+        return -1;
+    for (size_t tid = 0; tid < sim->threadCore.size(); tid++)
+        addCacheStats(stats, *sim->cores[sim->threadCore[tid]]->getCacheStats(sim->coreThread[tid]));
+    return 0;
+}
+
+int CORE_GetThreadCacheStats(CORE_Sim* sim, int threadid, cache_stats* stats){
+    const cache_stats* threadStats = sim->cores[sim->threadCore[threadid]]->getCacheStats(sim->coreThread[threadid]);
+    if (threadStats == NULL)
+        return -1;
+    *stats = *threadStats;
+    return 0;
+}
+
+int CORE_SetScoreboard(CORE_Sim* sim, int storeBuffer){
+    for (size_t k = 0; k < sim->cores.size(); k++)
+        if (!sim->cores[k]->setScoreboard(storeBuffer))
+            return -1;
+    return 0;
+}
+
+int CORE_SetMemory(CORE_Sim* sim, const memory_config* config){
+    for (size_t k = 0; k < sim->cores.size(); k++)
+        if (!sim->cores[k]->setMemory(*config))
+            return -1;
+    return 0;
+}
+
+int CORE_GetMemoryStats(CORE_Sim* sim, memory_stats* stats){
+    memset(stats, 0, sizeof(*stats));
+    if (!sim->cores[0]->hasMemory())
+        return -1;
+    for (size_t tid = 0; tid < sim->threadCore.size(); tid++){
+        const memory_stats* threadStats = sim->cores[sim->threadCore[tid]]->getMemoryStats(sim->coreThread[tid]);
+        stats->requests += threadStats->requests;
+        stats->queueCycles += threadStats->queueCycles;
+    }
+    return 0;
+}
+
+int CORE_GetThreadMemoryStats(CORE_Sim* sim, int threadid, memory_stats* stats){
+    const memory_stats* threadStats = sim->cores[sim->threadCore[threadid]]->getMemoryStats(sim->coreThread[threadid]);
+    if (threadStats == NULL)
+        return -1;
+    *stats = *threadStats;
+    return 0;
+}
+
+void CORE_SetTrace(CORE_Sim* sim, TRACE_Process* process){
+    CORE_SetCoreTrace(sim, 0, process);
+}
+
+void CORE_SetCoreTrace(CORE_Sim* sim, int coreNum, TRACE_Process* process){
+    sim->cores[coreNum]->setTrace(process);
+}
+
+void CORE_Destroy(CORE_Sim* sim){
+    if (sim == NULL)
+        return;
+    for (size_t k = 0; k < sim->cores.size(); k++)
+        delete sim->cores[k];
+    for (size_t k = 1; k < sim->memories.size(); k++)
+        SIM_CtxFree(sim->memories[k]);
+    delete sim;
+}
+
+CORE_Sim* core; // simulation of the default context
 
 
 void CORE_BlockedMT() {
-    core = new BlockedMt();
-    core->runSim();
+    core = CORE_Create(SIM_GetDefaultCtx(), CORE_MODEL_BLOCKED);
+    CORE_Run(core);
 }
 
 void CORE_FinegrainedMT() {
-    core = new FinegrainedMT();
-    core->runSim();
+    core = CORE_Create(SIM_GetDefaultCtx(), CORE_MODEL_FINEGRAINED);
+    CORE_Run(core);
+}
+
+static int smtWidth = CORE_SMT_DEFAULT_WIDTH; // issue of the default context's SMT simulation
+static int smtMemPorts = CORE_SMT_DEFAULT_MEM_PORTS;
+
+int CORE_SMT_Config(int width, int memPorts) {
+    if (width < 1 || memPorts < 1)
+        return -1;
+    smtWidth = width;
+    smtMemPorts = memPorts;
+    return 0;
+}
+
+void CORE_SMT() {
+    core = CORE_Create(SIM_GetDefaultCtx(), CORE_MODEL_SMT);
+    CORE_SetIssue(core, smtWidth, smtMemPorts);
+    CORE_Run(core);
 }
 
 double CORE_BlockedMT_CPI(){
-	double res = core->getCPI();
-	delete core;
+	double res = CORE_GetCPI(core);
+	CORE_Destroy(core);
 	return res;
 }
 
 double CORE_FinegrainedMT_CPI(){
-    double res = core->getCPI();
-    delete core;
+    double res = CORE_GetCPI(core);
+    CORE_Destroy(core);
+    return res;
+}
+
+double CORE_SMT_CPI(){
+    double res = CORE_GetCPI(core);
+    CORE_Destroy(core);
     return res;
 }
 
 void CORE_BlockedMT_CTX(tcontext* context, int threadid) {
-    core->getContext((context+threadid), threadid);
+    CORE_GetCTX(core, context, threadid);
 }
 
 void CORE_FinegrainedMT_CTX(tcontext* context, int threadid) {
-    core->getContext((context+threadid), threadid);
+    CORE_GetCTX(core, context, threadid);
+}
+
+void CORE_SMT_CTX(tcontext* context, int threadid) {
+    CORE_GetCTX(core, context, threadid);
 }
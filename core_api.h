@@ -8,6 +8,7 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include "sim_trace.h"
 
 #define REGS_COUNT 8
 
@@ -34,6 +35,100 @@ typedef struct _regs {
 	int reg[REGS_COUNT];
 } tcontext;
 
+/* Simulation context loaded from a memory image, see sim_api.h */
+typedef struct _sim_context SIM_Context;
+
+/* Core models that can be simulated on a context */
+typedef enum {
+	CORE_MODEL_BLOCKED = 0,
+	CORE_MODEL_FINEGRAINED,
+	CORE_MODEL_SMT, // simultaneous MT, issuing from several threads per cycle, see CORE_SetIssue
+} core_model;
+
+/* Thread selection policies of fine-grained MT */
+typedef enum {
+	CORE_POLICY_ROUND_ROBIN = 0, // the next ready thread after the current one, the CORE_MODEL_FINEGRAINED policy
+	CORE_POLICY_ICOUNT, // the ready thread that executed the fewest instructions, plus its outstanding scoreboard LOADs
+	CORE_POLICY_OLDEST_READY, // the thread that has been ready the longest, since it woke up or last executed
+	CORE_POLICY_WEIGHTED, // ready threads share the cycles by their weights, see CORE_SetThreadWeight
+	CORE_POLICY_COUNT,
+} core_policy;
+
+/* When blocked MT switches away from a thread that cannot run, see CORE_SetSwitchPolicy */
+typedef enum {
+	CORE_SWITCH_ON_HOLD = 0, // whenever the thread is held, for O cycles, the CORE_MODEL_BLOCKED policy
+	CORE_SWITCH_THRESHOLD, // only when its hold has more cycles left than a threshold, the core waits it out otherwise
+	CORE_SWITCH_ON_LOAD, // only when it waits on a LOAD, the core waits out STOREs
+	CORE_SWITCH_FLUSH, // whenever it is held, for as long as flushing its instructions in flight takes
+	CORE_SWITCH_COUNT,
+} core_switch;
+
+/* Issue of SMT simulations unless set otherwise */
+#define CORE_SMT_DEFAULT_WIDTH 2
+#define CORE_SMT_DEFAULT_MEM_PORTS 1
+
+/* A core simulation of one model over one context. Images whose threads run on several cores, see
+   SIM_CtxGetCoresNum, get a core of the model per core, each run on a host thread of its own */
+typedef struct _core_sim CORE_Sim;
+
+/* Cycle accounting of a core, collected by builds with SIM_STATS defined.
+   Every cycle of a run is an exec, switch or idle cycle. The cycles of a multi-core simulation are those of its
+   longest core, as in CORE_GetCPI, and its exec, switch and idle cycles sum over the cores, each idle from its
+   end to that of the longest, so that they add up to the cycles times the cores. */
+typedef struct {
+	double cycles;
+	double instructions;
+	double execCycles; // cycles in which a thread executed an instruction, SMT: in which any threads did
+	double switchCycles; // context switch overhead, blocked MT only
+	double idleCycles; // cycles in which no thread could run
+} core_stats;
+
+/* Cycle accounting of a thread, collected by builds with SIM_STATS defined */
+typedef struct {
+	double instructions;
+	double loadStallCycles; // cycles the thread waited on its loads
+	double storeStallCycles; // cycles the thread waited on its stores
+	double haltCycle; // core cycle in which the thread halted, 0 if it did not
+} thread_stats;
+
+/* Replacement of a data cache, within the ways of a set */
+typedef enum {
+	CORE_CACHE_LRU = 0, // the least recently used way
+	CORE_CACHE_PLRU, // tree pseudo-LRU, a bit per node of a binary tree over the ways
+} cache_replacement;
+
+/* Geometry and latencies of the L1 data cache of a core, see CORE_SetCache.
+   Size, ways and line size are powers of 2, in bytes, lines of at least 4 bytes and at most 64 ways */
+typedef struct {
+	int size;
+	int ways;
+	int lineSize;
+	int hitLat; // cycles a LOAD or STORE that hits holds its thread, instead of the L or S of the image
+	int missLat; // the same for one that misses, the missing line replaces a line of its set
+	cache_replacement replacement;
+} cache_config;
+
+/* Data cache accesses of a thread or a whole simulation, see CORE_GetCacheStats */
+typedef struct {
+	double loads;
+	double loadHits;
+	double stores;
+	double storeHits;
+} cache_stats;
+
+/* Requests a core has in flight to the data memory, see CORE_SetMemory. Every LOAD that reaches the memory,
+   or misses the data cache, is a request. STOREs retire without one */
+typedef struct {
+	int outstanding; // requests in flight at once, a LOAD that finds them all taken queues for the first to complete
+	int bandwidth; // requests that start per cycle
+} memory_config;
+
+/* Memory requests of a thread or a whole simulation, see CORE_GetMemoryStats */
+typedef struct {
+	double requests;
+	double queueCycles; // cycles the requests waited for a free slot before they started
+} memory_stats;
+
 
 /* Simulates blocked MT and fine-grained MT behavior, respectively */
 void CORE_BlockedMT();
@@ -47,6 +142,103 @@ void CORE_FinegrainedMT_CTX(tcontext context[], int threadid);
 double CORE_BlockedMT_CPI();
 double CORE_FinegrainedMT_CPI();
 
+/* The same for SMT, whose issue width and memory ports are set by CORE_SMT_Config beforehand.
+   CORE_SMT_Config returns 0 for success, <0 if width or memPorts is below 1 */
+int CORE_SMT_Config(int width, int memPorts);
+void CORE_SMT();
+void CORE_SMT_CTX(tcontext context[], int threadid);
+double CORE_SMT_CPI();
+
+/* Reentrant API: the functions above simulate the default context of sim_api.h
+   through a single global simulation, these work on any context.
+   A context must not be simulated by two runs at once, since runs write its data memory. */
+
+/* Create a simulation of the given model over a context, NULL on failure */
+CORE_Sim* CORE_Create(SIM_Context* ctx, core_model model);
+
+/* Create a fine-grained MT simulation that picks the thread of every cycle by the given policy, NULL on failure */
+CORE_Sim* CORE_CreateFinegrained(SIM_Context* ctx, core_policy policy);
+
+/* Name of a policy, NULL if there is no such policy */
+const char* CORE_PolicyName(core_policy policy);
+
+/* Heaviest weight of a thread under CORE_POLICY_WEIGHTED */
+#define CORE_MAX_THREAD_WEIGHT (1 << 20)
+
+/* Set the weight of a thread under CORE_POLICY_WEIGHTED, all threads weigh 1 unless set. Set before running it,
+   returns 0 for success, <0 if the simulation has no weights, there is no such thread or weight is outside
+   [1, CORE_MAX_THREAD_WEIGHT] */
+int CORE_SetThreadWeight(CORE_Sim* sim, int threadid, int weight);
+
+/* Run the simulation until all threads halt */
+void CORE_Run(CORE_Sim* sim);
+
+/* Get thread register file of a finished simulation */
+void CORE_GetCTX(CORE_Sim* sim, tcontext context[], int threadid);
+
+/* Return performance of a finished simulation in CPI metric. Cores run side by side, so the CPI of a
+   multi-core simulation is the cycles of its longest core over the instructions of all cores */
+double CORE_GetCPI(CORE_Sim* sim);
+
+/* Number of cores of a simulation, and the CPI of one of them over its own threads */
+int CORE_GetCoresNum(CORE_Sim* sim);
+double CORE_GetCoreCPI(CORE_Sim* sim, int core);
+
+/* Return Jain's fairness index of a finished simulation over the throughput of its threads, every thread's
+   instructions over the cycles it took to halt: 1 if all progressed alike, down to 1/threads */
+double CORE_GetFairness(CORE_Sim* sim);
+
+/* Get the cycle accounting of a finished simulation, returns 0 for success, <0 if the build does not collect it */
+int CORE_GetStats(CORE_Sim* sim, core_stats* stats);
+int CORE_GetThreadStats(CORE_Sim* sim, int threadid, thread_stats* stats);
+
+/* Set the instructions an SMT simulation issues per cycle (width), of which memPorts may be LOADs or STOREs.
+   Set before running it, returns 0 for success, <0 if the simulation is not SMT or a value is below 1 */
+int CORE_SetIssue(CORE_Sim* sim, int width, int memPorts);
+
+/* Put an L1 data cache in front of the data memory of every core of a simulation, each core has its own.
+   Set before running it, returns 0 for success, <0 if the geometry is invalid */
+int CORE_SetCache(CORE_Sim* sim, const cache_config* config);
+
+/* Get the data cache accesses of a finished simulation, or of one of its threads.
+   Returns 0 for success, <0 if the simulation has no cache */
+int CORE_GetCacheStats(CORE_Sim* sim, cache_stats* stats);
+int CORE_GetThreadCacheStats(CORE_Sim* sim, int threadid, cache_stats* stats);
+
+/* Set when a blocked MT simulation switches threads, see core_switch. Under CORE_SWITCH_FLUSH the instructions
+   the thread issued in its last O issue slots are in flight, a switch flushes them at a cycle for every ALU
+   instruction and two for every LOAD or STORE, at least one cycle. Set before running it, returns 0 for success,
+   <0 if the simulation is not blocked MT or the threshold is negative */
+int CORE_SetSwitchPolicy(CORE_Sim* sim, core_switch policy, int threshold);
+
+/* Name of a switch policy, NULL if there is no such policy */
+const char* CORE_SwitchName(core_switch policy);
+
+/* Run a simulation in scoreboard mode: a LOAD marks its destination register pending until its data returns
+   and the thread goes on issuing until an instruction reads or writes a pending register, a STORE retires into
+   a buffer of storeBuffer entries per thread that drains one store at a time and stalls the thread only when
+   it is full. Set before running it, returns 0 for success, <0 if storeBuffer is below 1 */
+int CORE_SetScoreboard(CORE_Sim* sim, int storeBuffer);
+
+/* Bound the requests every core has in flight to the data memory and the requests that start per cycle,
+   instead of every LOAD starting at once. Set before running it, returns 0 for success, <0 if a value is below 1 */
+int CORE_SetMemory(CORE_Sim* sim, const memory_config* config);
+
+/* Get the memory requests of a finished simulation, or of one of its threads.
+   Returns 0 for success, <0 if the simulation has no bounded memory */
+int CORE_GetMemoryStats(CORE_Sim* sim, memory_stats* stats);
+int CORE_GetThreadMemoryStats(CORE_Sim* sim, int threadid, memory_stats* stats);
+
+/* Trace the scheduling of a simulation into a process of a trace, see sim_trace.h. Set before running it */
+void CORE_SetTrace(CORE_Sim* sim, TRACE_Process* process);
+
+/* The same for one core of a multi-core simulation, whose tracks are the threads of the core in order.
+   Every core needs its own process, CORE_SetTrace traces the first core */
+void CORE_SetCoreTrace(CORE_Sim* sim, int core, TRACE_Process* process);
+
+/* Free a simulation, the context stays valid */
+void CORE_Destroy(CORE_Sim* sim);
+
 #ifdef __cplusplus
 }
 #endif
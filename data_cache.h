@@ -0,0 +1,168 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+
+#ifndef DATA_CACHE_H_
+#define DATA_CACHE_H_
+
+#include "core_api.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * set-associative L1 data cache of a core, a timing model only: the data stays in the data memory of the
+ * context, the cache decides how long a LOAD or STORE holds its thread. STOREs allocate their line like LOADs.
+ * the tags of a set lie next to each other, so a lookup is a shift, a mask and a scan over the ways.
+ */
+class DataCache{
+    static const uint32_t invalidTag = 0xFFFFFFFF; // no line number reaches it, lines are at least 4 bytes
+
+    int ways;
+    int lineShift;
+    uint32_t setMask;
+    int hitLat;
+    int missLat;
+    cache_replacement replacement;
+    std::vector<uint32_t> tags; // line number held by every way of every set, set after set
+    std::vector<uint64_t> lastUse; // LRU: access stamp of every way
+    std::vector<uint64_t> treeBits; // PLRU: the tree of every set, bit n - 1 is node n of a heap over the ways
+    uint64_t stamp;
+    std::vector<cache_stats> threadStats;
+
+    static bool isPowerOf2(int value){
+        return value > 0 && (value & (value - 1)) == 0;
+    }
+
+    static int log2(int value){
+        return __builtin_ctz((unsigned)value);
+    }
+
+    /**
+     * points the tree of a set away from a way, towards the least recently used half on every level
+     */
+    void touchTree(uint32_t set, int way){
+        uint64_t& bits = treeBits[set];
+        int node = 1;
+        for (int half = ways >> 1; half > 0; half >>= 1){
+            bool right = (way & half) != 0;
+            if (right)
+                bits &= ~(1ULL << (node - 1)); // the left half is older
+            else
+                bits |= 1ULL << (node - 1); // the right half is older
+            node = 2 * node + right;
+        }
+    }
+
+    /**
+     * @return the way the tree of a set points to
+     */
+    int treeVictim(uint32_t set) const{
+        uint64_t bits = treeBits[set];
+        int node = 1;
+        int way = 0;
+        for (int half = ways >> 1; half > 0; half >>= 1){
+            bool right = (bits >> (node - 1)) & 1;
+            way |= right ? half : 0;
+            node = 2 * node + right;
+        }
+        return way;
+    }
+
+public:
+    DataCache(): ways(0), lineShift(0), setMask(0), hitLat(0), missLat(0), replacement(CORE_CACHE_LRU), stamp(0){}
+
+    bool enabled() const{
+        return ways > 0;
+    }
+
+    int minLatency() const{
+        return hitLat < missLat ? hitLat : missLat;
+    }
+
+    /**
+     * @param config - geometry and latencies of the cache
+     * @param threads - threads of the core, misses are counted per thread
+     * @return false if the geometry is not a power of 2 or does not add up, the cache is left as it was
+     */
+    bool configure(const cache_config& config, int threads){
+        if (!isPowerOf2(config.size) || !isPowerOf2(config.ways) || !isPowerOf2(config.lineSize) ||
+            config.lineSize < 4 || config.ways > 64 || config.size < config.ways * config.lineSize ||
+            config.hitLat < 0 || config.missLat < 0 ||
+            (config.replacement != CORE_CACHE_LRU && config.replacement != CORE_CACHE_PLRU))
+            return false;
+        int sets = config.size / (config.ways * config.lineSize);
+        ways = config.ways;
+        lineShift = log2(config.lineSize);
+        setMask = (uint32_t)sets - 1;
+        hitLat = config.hitLat;
+        missLat = config.missLat;
+        replacement = config.replacement;
+        tags.assign((size_t)sets * ways, (uint32_t)invalidTag);
+        lastUse.assign(replacement == CORE_CACHE_LRU ? (size_t)sets * ways : 0, 0);
+        treeBits.assign(replacement == CORE_CACHE_PLRU ? sets : 0, 0);
+        stamp = 0;
+        cache_stats noStats = {0, 0, 0, 0};
+        threadStats.assign(threads, noStats);
+        return true;
+    }
+
+    /**
+     * @return the cycles an access that hits or misses holds its thread
+     */
+    int latency(bool hit) const{
+        return hit ? hitLat : missLat;
+    }
+
+    /**
+     * looks an address up, on a miss its line replaces the victim of its set
+     * @param threadNum - thread of the core making the access
+     * @return true if the access hits
+     */
+    bool access(uint32_t addr, int threadNum, bool store){
+        uint32_t line = addr >> lineShift;
+        uint32_t set = line & setMask;
+        uint32_t* setTags = &tags[(size_t)set * ways];
+        cache_stats& stats = threadStats[threadNum];
+        if (store)
+            stats.stores++;
+        else
+            stats.loads++;
+        int way = 0;
+        while (way < ways && setTags[way] != line)
+            way++;
+        bool hit = way < ways;
+        if (hit){
+            if (store)
+                stats.storeHits++;
+            else
+                stats.loadHits++;
+        }
+        else if (replacement == CORE_CACHE_PLRU){
+            way = treeVictim(set);
+            setTags[way] = line;
+        }
+        else { // invalid ways were never used and come first
+            uint64_t* setUse = &lastUse[(size_t)set * ways];
+            way = 0;
+            for (int w = 1; w < ways; w++)
+                if (setUse[w] < setUse[way])
+                    way = w;
+            setTags[way] = line;
+        }
+        if (replacement == CORE_CACHE_PLRU)
+            touchTree(set, way);
+        else
+            lastUse[(size_t)set * ways + way] = ++stamp;
+        return hit;
+    }
+
+    /**
+     * @param threadNum - thread of the core to get
+     * @return the accesses and hits of the thread
+     */
+    const cache_stats& getThreadStats(int threadNum) const{
+        return threadStats[threadNum];
+    }
+};
+
+#endif /* DATA_CACHE_H_ */
@@ -0,0 +1,200 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+/* Text to binary memory image converter               */
+
+#include "core_api.h"
+#include "sim_api.h"
+#include "sim_report.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+static const int streamWindow = 16; // smallest window, so that streams of the test images wrap around
+
+static bool endsWith(const string& str, const string& suffix){
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/**
+ * adds the images of a path, directories contribute their .in and .img files
+ * @return false if the path does not exist
+ */
+static bool collectImages(const string& path, vector<string>& images){
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    if (!S_ISDIR(st.st_mode)){
+        images.push_back(path);
+        return true;
+    }
+    DIR* dir = opendir(path.c_str());
+    if (dir == NULL)
+        return false;
+    vector<string> found;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL){
+        string name = entry->d_name;
+        if (endsWith(name, ".in") || endsWith(name, ".img"))
+            found.push_back(path + "/" + name);
+    }
+    closedir(dir);
+    sort(found.begin(), found.end());
+    images.insert(images.end(), found.begin(), found.end());
+    return true;
+}
+
+/**
+ * @return true if both contexts hold the same parameters and programs
+ */
+static bool samePrograms(const SIM_Context* a, const SIM_Context* b){
+    if (SIM_CtxGetLoadLat(a) != SIM_CtxGetLoadLat(b) || SIM_CtxGetStoreLat(a) != SIM_CtxGetStoreLat(b) ||
+        SIM_CtxGetSwitchCycles(a) != SIM_CtxGetSwitchCycles(b) || SIM_CtxGetThreadsNum(a) != SIM_CtxGetThreadsNum(b))
+        return false;
+    for (int tid = 0; tid < SIM_CtxGetThreadsNum(a); tid++){
+        if (SIM_CtxGetInstCount(a, tid) != SIM_CtxGetInstCount(b, tid))
+            return false;
+        for (int line = 0; line < SIM_CtxGetInstCount(a, tid); line++){
+            Instruction instA, instB;
+            SIM_CtxMemInstRead(a, line, &instA, tid);
+            SIM_CtxMemInstRead(b, line, &instB, tid);
+            if (instA.opcode != instB.opcode || instA.dst_index != instB.dst_index ||
+                instA.src1_index != instB.src1_index || instA.src2_index_imm != instB.src2_index_imm ||
+                instA.isSrc2Imm != instB.isSrc2Imm)
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * converts an image to a binary one, loads it back, mapped and streamed, and checks that all simulate the same
+ * @param binFname - scratch file for the binary image
+ * @return true if the round trip preserved the image
+ */
+static bool roundTrip(const string& image, const char* binFname){
+    SIM_Context* text = SIM_CtxCreate(image.c_str());
+    if (text == NULL || SIM_CtxSave(text, binFname) != 0){
+        SIM_CtxFree(text);
+        return false;
+    }
+    SIM_Context* binary = SIM_CtxCreate(binFname);
+    SIM_Context* streamed = SIM_CtxCreateStreamed(binFname, streamWindow);
+    bool same = binary != NULL && streamed != NULL && samePrograms(text, binary);
+    char* textReport = same ? REPORT_Run(text, REPORT_SHARED_MEMORY) : NULL;
+    char* binReport = same ? REPORT_Run(binary, REPORT_SHARED_MEMORY) : NULL;
+    char* streamReport = same ? REPORT_Run(streamed, REPORT_SHARED_MEMORY) : NULL;
+    same = textReport != NULL && binReport != NULL && streamReport != NULL &&
+           strcmp(textReport, binReport) == 0 && strcmp(textReport, streamReport) == 0;
+    free(textReport);
+    free(binReport);
+    free(streamReport);
+    SIM_CtxFree(streamed);
+    SIM_CtxFree(binary);
+    SIM_CtxFree(text);
+    return same;
+}
+
+/**
+ * saves a single instruction image, overwrites a byte of the instruction record and loads the image back
+ * @param field - byte of the record to overwrite: 0 the opcode, 1 the dst register, 2 src1
+ * @return true if the corrupt image is rejected, mapped and streamed
+ */
+static bool corruptRejected(const char* binFname, int field, unsigned char value){
+    const int32_t mark = 0x5A5A5A5A; // immediate that finds the record in the file
+    Instruction inst = {CMD_ADDI, 1, 2, mark, true};
+    SIM_Context* ctx = SIM_CtxCreateEmpty(1, 1, 1, 1);
+    bool saved = ctx != NULL && SIM_CtxAppendInst(ctx, 0, &inst) == 0 && SIM_CtxSave(ctx, binFname) == 0;
+    SIM_CtxFree(ctx);
+    string image;
+    ifstream in(binFname, ios::in | ios::binary);
+    ostringstream buf;
+    buf << in.rdbuf();
+    image = buf.str();
+    size_t record = image.find(string((const char*)&mark, sizeof(mark)));
+    if (!saved || record == string::npos || record < 4)
+        return false;
+    image[record - 4 + field] = (char)value;
+    ofstream out(binFname, ios::out | ios::binary | ios::trunc);
+    out << image;
+    out.close();
+    SIM_Context* binary = SIM_CtxCreate(binFname);
+    SIM_Context* streamed = SIM_CtxCreateStreamed(binFname, streamWindow);
+    bool rejected = binary == NULL && streamed == NULL;
+    SIM_CtxFree(streamed);
+    SIM_CtxFree(binary);
+    return rejected;
+}
+
+static int checkRoundTrip(const vector<string>& paths){
+    vector<string> images;
+    for (size_t i = 0; i < paths.size(); i++){
+        if (!collectImages(paths[i], images)){
+            fprintf(stderr, "No such image or directory: %s\n", paths[i].c_str());
+            return 2;
+        }
+    }
+    char binFname[] = "/tmp/img_convert_XXXXXX";
+    int fd = mkstemp(binFname);
+    if (fd < 0){
+        fprintf(stderr, "Failed creating a temporary image!\n");
+        return 2;
+    }
+    close(fd);
+    int failed = 0;
+    for (size_t i = 0; i < images.size(); i++){
+        if (!roundTrip(images[i], binFname)){
+            printf("FAIL  %s\n", images[i].c_str());
+            failed++;
+        }
+    }
+    bool corrupt = false;
+    Instruction badReg = {CMD_ADD, REGS_COUNT, 0, 0, false};
+    SIM_Context* empty = SIM_CtxCreateEmpty(1, 1, 1, 1);
+    if (empty == NULL || SIM_CtxAppendInst(empty, 0, &badReg) == 0 || !corruptRejected(binFname, 0, CMD_HALT + 1) ||
+        !corruptRejected(binFname, 1, REGS_COUNT) || !corruptRejected(binFname, 2, 0xFF)){
+        printf("FAIL  corrupt instructions were loaded\n");
+        corrupt = true;
+    }
+    SIM_CtxFree(empty);
+    unlink(binFname);
+    printf("%zu images: %zu round trips passed, %d failed\n", images.size(), images.size() - failed, failed);
+    return (failed || corrupt) ? 1 : 0;
+}
+
+static void usage(const char* prog){
+    fprintf(stderr, "usage: %s <image> <binary image>\n", prog);
+    fprintf(stderr, "       %s -t <image or directory>...\n", prog);
+    fprintf(stderr, "  -t converts every image and checks that the binary image simulates the same, mapped and streamed,\n"
+                    "     and that binary images with corrupt instructions are rejected\n");
+}
+
+int main(int argc, char const *argv[]){
+    if (argc >= 3 && strcmp(argv[1], "-t") == 0)
+        return checkRoundTrip(vector<string>(argv + 2, argv + argc));
+    if (argc != 3 || argv[1][0] == '-'){
+        usage(argv[0]);
+        return 1;
+    }
+    SIM_Context* ctx = SIM_CtxCreate(argv[1]);
+    if (ctx == NULL){
+        fprintf(stderr, "Failed initializing memory simulator!\n");
+        return 2;
+    }
+    int ret = SIM_CtxSave(ctx, argv[2]);
+    SIM_CtxFree(ctx);
+    if (ret != 0){
+        fprintf(stderr, "Failed writing %s\n", argv[2]);
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,188 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+/* Synthetic memory image generator                    */
+
+#include "core_api.h"
+#include "sim_api.h"
+#include "sim_gen.h"
+#include "sim_report.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * @return true if both contexts hold the same parameters and programs
+ */
+static bool samePrograms(const SIM_Context* a, const SIM_Context* b){
+    if (SIM_CtxGetLoadLat(a) != SIM_CtxGetLoadLat(b) || SIM_CtxGetStoreLat(a) != SIM_CtxGetStoreLat(b) ||
+        SIM_CtxGetSwitchCycles(a) != SIM_CtxGetSwitchCycles(b) || SIM_CtxGetThreadsNum(a) != SIM_CtxGetThreadsNum(b))
+        return false;
+    for (int tid = 0; tid < SIM_CtxGetThreadsNum(a); tid++){
+        if (SIM_CtxGetInstCount(a, tid) != SIM_CtxGetInstCount(b, tid))
+            return false;
+        for (int line = 0; line < SIM_CtxGetInstCount(a, tid); line++){
+            Instruction instA, instB;
+            SIM_CtxMemInstRead(a, line, &instA, tid);
+            SIM_CtxMemInstRead(b, line, &instB, tid);
+            if (instA.opcode != instB.opcode || instA.dst_index != instB.dst_index ||
+                instA.src1_index != instB.src1_index || instA.src2_index_imm != instB.src2_index_imm ||
+                instA.isSrc2Imm != instB.isSrc2Imm)
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @return true if both contexts hold the same data in the first words of the data memory
+ */
+static bool sameData(SIM_Context* a, SIM_Context* b, uint32_t words){
+    for (uint32_t word = 0; word < words; word++){
+        int32_t valA, valB;
+        SIM_CtxMemDataRead(a, 4 * word, &valA);
+        SIM_CtxMemDataRead(b, 4 * word, &valB);
+        if (valA != valB)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * generates a workload as a text image and in memory, and checks that both hold and simulate the same,
+ * that generating it again gives the same and that another seed does not
+ * @param imgFname - scratch file for the text image
+ * @return true if all hold
+ */
+static bool checkParams(const gen_params& params, const char* imgFname){
+    SIM_Context* generated = GEN_Create(&params);
+    SIM_Context* again = GEN_Create(&params);
+    gen_params reseeded = params;
+    reseeded.seed++;
+    SIM_Context* other = GEN_Create(&reseeded);
+    SIM_Context* parsed = (GEN_WriteImage(&params, imgFname) == 0) ? SIM_CtxCreate(imgFname) : NULL;
+    bool ok = generated != NULL && again != NULL && other != NULL && parsed != NULL &&
+              samePrograms(generated, parsed) && sameData(generated, parsed, params.footprint) &&
+              samePrograms(generated, again) &&
+              (params.threads == 0 || params.instructions < 8 || !samePrograms(generated, other));
+    char* generatedReport = ok ? REPORT_Run(generated, REPORT_SHARED_MEMORY) : NULL;
+    char* parsedReport = ok ? REPORT_Run(parsed, REPORT_SHARED_MEMORY) : NULL;
+    ok = generatedReport != NULL && parsedReport != NULL && strcmp(generatedReport, parsedReport) == 0;
+    free(generatedReport);
+    free(parsedReport);
+    SIM_CtxFree(parsed);
+    SIM_CtxFree(other);
+    SIM_CtxFree(again);
+    SIM_CtxFree(generated);
+    return ok;
+}
+
+/**
+ * checks the generator over a few corners of its parameters
+ */
+static int selfTest(){
+    char imgFname[] = "/tmp/img_gen_XXXXXX";
+    int fd = mkstemp(imgFname);
+    if (fd < 0){
+        fprintf(stderr, "Failed creating a temporary image!\n");
+        return 2;
+    }
+    close(fd);
+    gen_params cases[6];
+    for (int i = 0; i < 6; i++)
+        GEN_Defaults(&cases[i]);
+    cases[1].memPercent = 0; // no memory, no data
+    cases[1].footprint = 0;
+    cases[2].memPercent = 100; // all memory, all dependent
+    cases[2].depPercent = 100;
+    cases[2].storePercent = 50;
+    cases[3].threads = 1000; // many short threads
+    cases[3].instructions = 20;
+    cases[4].threads = 1; // one long thread
+    cases[4].instructions = 100000;
+    cases[4].footprint = 1 << 16;
+    cases[5].threads = 0;
+    int failed = 0;
+    for (int i = 0; i < 6; i++){
+        if (!checkParams(cases[i], imgFname)){
+            printf("FAIL  case %d\n", i);
+            failed++;
+        }
+    }
+    unlink(imgFname);
+    printf("6 cases: %d passed, %d failed\n", 6 - failed, failed);
+    return failed ? 1 : 0;
+}
+
+static void usage(const char* prog){
+    gen_params defaults;
+    GEN_Defaults(&defaults);
+    fprintf(stderr, "usage: %s [-s seed] [-N threads] [-n instructions] [-m memory %%] [-w store %%] [-d dependent %%]\n"
+            "       [-f footprint] [-L load latency] [-S store latency] [-O switch overhead] [-b] <image>\n", prog);
+    fprintf(stderr, "       %s -t\n", prog);
+    fprintf(stderr, "  -n instructions of every thread with its HALT, -m LOADs and STOREs out of all instructions,\n");
+    fprintf(stderr, "  -w STOREs out of LOADs and STOREs, -d instructions that read the destination of the one before,\n");
+    fprintf(stderr, "  -f data words addressed. defaults: -s %llu -N %d -n %ld -m %d -w %d -d %d -f %u -L %d -S %d -O %d\n",
+            defaults.seed, defaults.threads, defaults.instructions, defaults.memPercent, defaults.storePercent,
+            defaults.depPercent, defaults.footprint, defaults.loadLat, defaults.storeLat, defaults.switchCycles);
+    fprintf(stderr, "  -b writes a binary image instead of a text one, -t checks the generator\n");
+}
+
+int main(int argc, char const *argv[]){
+    if (argc == 2 && strcmp(argv[1], "-t") == 0)
+        return selfTest();
+    gen_params params;
+    GEN_Defaults(&params);
+    const char* imgFname = NULL;
+    bool binary = false;
+    for (int i = 1; i < argc; i++){
+        string arg = argv[i];
+        if (arg == "-b"){
+            binary = true;
+            continue;
+        }
+        if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc){
+            const char* value = argv[++i];
+            switch (arg[1]) {
+                case 's': params.seed = strtoull(value, NULL, 0); continue;
+                case 'N': params.threads = atoi(value); continue;
+                case 'n': params.instructions = atol(value); continue;
+                case 'm': params.memPercent = atoi(value); continue;
+                case 'w': params.storePercent = atoi(value); continue;
+                case 'd': params.depPercent = atoi(value); continue;
+                case 'f': params.footprint = (uint32_t)strtoul(value, NULL, 0); continue;
+                case 'L': params.loadLat = atoi(value); continue;
+                case 'S': params.storeLat = atoi(value); continue;
+                case 'O': params.switchCycles = atoi(value); continue;
+            }
+            i--;
+        }
+        if (arg[0] == '-' || imgFname != NULL){
+            usage(argv[0]);
+            return 1;
+        }
+        imgFname = argv[i];
+    }
+    if (imgFname == NULL){
+        usage(argv[0]);
+        return 1;
+    }
+    if (binary){
+        SIM_Context* ctx = GEN_Create(&params);
+        int ret = (ctx == NULL) ? -1 : SIM_CtxSave(ctx, imgFname);
+        SIM_CtxFree(ctx);
+        if (ret != 0){
+            fprintf(stderr, "Failed generating %s\n", imgFname);
+            return 2;
+        }
+        return 0;
+    }
+    if (GEN_WriteImage(&params, imgFname) != 0){
+        fprintf(stderr, "Failed generating %s\n", imgFname);
+        return 2;
+    }
+    return 0;
+}
@@ -1,59 +1,226 @@
 /* 046267 Computer Architecture - Spring 2020 - HW #4 */
 
 #include <stdio.h>
+#include <string.h>
 #include "core_api.h"
 #include "sim_api.h"
+#include "sim_report.h"
+
+static void usage(char const *prog) {
+	fprintf(stderr, "usage: %s [--shared-mem | --independent] [--stats-json <file>] [--trace <file> [--trace-window <first>:<last>]]"
+	        " [--smt <width>[:<memory ports>]] [--policies [--weights <w0>,<w1>,...]] [--cores <cores>]"
+	        " [--cache <size>:<ways>:<line size>:<hit latency>:<miss latency>[:lru|:plru]]"
+	        " [--memory <outstanding>:<bandwidth>] [--scoreboard <store buffer entries>]"
+	        " [--switch-policies [--switch-threshold <cycles>]] <memory image>\n", prog);
+	fprintf(stderr, "  --shared-mem   fine-grained MT starts from the memory blocked MT left (default)\n");
+	fprintf(stderr, "  --independent  both models run in parallel, each on its own copy of the loaded memory\n");
+	fprintf(stderr, "  --stats-json   writes the cycle accounting of both models, needs a build with SIM_STATS\n");
+	fprintf(stderr, "  --trace        writes a Chrome trace of the scheduling of both models, of the given cycles only\n");
+	fprintf(stderr, "  --smt          also simulates an SMT core issuing up to <width> instructions per cycle,\n"
+	                "                 <memory ports> of them LOADs or STOREs (default %d)\n", CORE_SMT_DEFAULT_MEM_PORTS);
+	fprintf(stderr, "  --policies     also compares the CPI and fairness of the thread selection policies of fine-grained MT,\n"
+	                "                 the weighted one with the given thread weights (default 1, at most %d)\n",
+	                CORE_MAX_THREAD_WEIGHT);
+	fprintf(stderr, "  --cores        spreads the threads over that many cores round robin, instead of the C line of the image,\n"
+	                "                 at most one core per thread\n");
+	fprintf(stderr, "  --cache        puts a data cache in front of the memory of every core, sizes in bytes and powers of 2,\n"
+	                "                 LOADs and STOREs take the hit or miss latency instead of L and S (default lru)\n");
+	fprintf(stderr, "  --memory       every core has at most <outstanding> LOADs in flight to the memory, of which <bandwidth>\n"
+	                "                 start per cycle, LOADs that find no free slot queue for one\n");
+	fprintf(stderr, "  --scoreboard   threads stall on the first use of a loaded register instead of on the LOAD,\n"
+	                "                 and STOREs retire into a store buffer of that many entries per thread\n");
+	fprintf(stderr, "  --switch-policies  also compares the CPI of the switch policies of blocked MT and picks the lowest,\n"
+	                "                 the threshold one waiting out holds of up to the given cycles (default O)\n");
+}
 
 int main(int argc, char const *argv[]){
-	char const *memFname = argv[1];
+	char const *memFname = NULL;
+	char const *statsFname = NULL;
+	char const *traceFname = NULL;
+	long long traceFirst = 0, traceLast = -1;
+	int smtWidth = 0, smtMemPorts = CORE_SMT_DEFAULT_MEM_PORTS;
+	bool policies = false;
+	int *weights = NULL;
+	int weightsCount = 0;
+	int cores = 0;
+	cache_config cache = {0, 0, 0, 0, 0, CORE_CACHE_LRU};
+	bool cached = false;
+	memory_config memory = {0, 0};
+	bool bounded = false;
+	int storeBuffer = 0;
+	bool switchPolicies = false;
+	int switchThreshold = -1;
+	report_mode mode = REPORT_SHARED_MEMORY;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--shared-mem") == 0) {
+			mode = REPORT_SHARED_MEMORY;
+		} else if (strcmp(argv[i], "--independent") == 0) {
+			mode = REPORT_INDEPENDENT;
+		} else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc) {
+			statsFname = argv[++i];
+		} else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			traceFname = argv[++i];
+		} else if (strcmp(argv[i], "--trace-window") == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%lld:%lld", &traceFirst, &traceLast) != 2 || traceFirst < 0 || traceLast < traceFirst) {
+				usage(argv[0]);
+				exit(1);
+			}
+		} else if (strcmp(argv[i], "--smt") == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%d:%d", &smtWidth, &smtMemPorts) < 1 || smtWidth < 1 || smtMemPorts < 1) {
+				usage(argv[0]);
+				exit(1);
+			}
+		} else if (strcmp(argv[i], "--policies") == 0) {
+			policies = true;
+		} else if (strcmp(argv[i], "--weights") == 0 && i + 1 < argc) {
+			const char *list = argv[++i];
+			free(weights);
+			weights = malloc(sizeof(*weights) * (strlen(list) / 2 + 1)); // at most every other character is a weight
+			if (weights == NULL) {
+				fprintf(stderr, "Failed allocating the thread weights!\n");
+				exit(2);
+			}
+			weightsCount = 0;
+			for (char *end; *list != '\0'; list = (*end == ',') ? end + 1 : end) {
+				long weight = strtol(list, &end, 10);
+				if (end == list || weight < 1 || weight > CORE_MAX_THREAD_WEIGHT || (*end != ',' && *end != '\0')) {
+					usage(argv[0]);
+					exit(1);
+				}
+				weights[weightsCount++] = (int)weight;
+			}
+		} else if (strcmp(argv[i], "--cores") == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%d", &cores) != 1 || cores < 1) {
+				usage(argv[0]);
+				exit(1);
+			}
+		} else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+			char replacement[8] = "lru";
+			int fields = sscanf(argv[++i], "%d:%d:%d:%d:%d:%7s", &cache.size, &cache.ways, &cache.lineSize,
+			                    &cache.hitLat, &cache.missLat, replacement);
+			if (fields < 5 || (strcmp(replacement, "lru") != 0 && strcmp(replacement, "plru") != 0)) {
+				usage(argv[0]);
+				exit(1);
+			}
+			cache.replacement = (strcmp(replacement, "plru") == 0) ? CORE_CACHE_PLRU : CORE_CACHE_LRU;
+			cached = true;
+		} else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%d:%d", &memory.outstanding, &memory.bandwidth) != 2 ||
+			    memory.outstanding < 1 || memory.bandwidth < 1) {
+				usage(argv[0]);
+				exit(1);
+			}
+			bounded = true;
+		} else if (strcmp(argv[i], "--switch-policies") == 0) {
+			switchPolicies = true;
+		} else if (strcmp(argv[i], "--switch-threshold") == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%d", &switchThreshold) != 1 || switchThreshold < 0) {
+				usage(argv[0]);
+				exit(1);
+			}
+		} else if (strcmp(argv[i], "--scoreboard") == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%d", &storeBuffer) != 1 || storeBuffer < 1) {
+				usage(argv[0]);
+				exit(1);
+			}
+		} else if (argv[i][0] == '-' || memFname != NULL) {
+			usage(argv[0]);
+			exit(1);
+		} else {
+			memFname = argv[i];
+		}
+	}
+	if (memFname == NULL) {
+		usage(argv[0]);
+		exit(1);
+	}
 
-	if (SIM_MemReset(memFname) != 0) {
+	SIM_Context *ctx = SIM_CtxCreate(memFname);
+	if (ctx == NULL) {
 		fprintf(stderr, "Failed initializing memory simulator!\n");
 	    exit(2);
 	}
-
-	int threads = SIM_GetThreadsNum();
-
-    // Allocate register files
-    tcontext *blocked = (tcontext*)malloc(threads * sizeof(tcontext));
-    tcontext *finegrained = (tcontext*)malloc(threads * sizeof(tcontext));
-    
-    // Init thread registers
-	for(int k=0; k<threads; k++) {
-	    for (int i=0; i<REGS_COUNT; i++) {
-	        finegrained[k].reg[i] = 0;
-	    	blocked[k].reg[i] = 0;
-	    }
+	if (cores > SIM_CtxGetThreadsNum(ctx)) {
+		fprintf(stderr, "Cannot spread %d threads over %d cores\n", SIM_CtxGetThreadsNum(ctx), cores);
+		SIM_CtxFree(ctx);
+		exit(1);
+	}
+	if (cores > 0 && SIM_CtxSetCores(ctx, cores, NULL) != 0) {
+		fprintf(stderr, "Failed setting %d cores\n", cores);
+		SIM_CtxFree(ctx);
+		exit(2);
 	}
 
-    // Start blocked MT simulation
-	CORE_BlockedMT();
-	printf("\n---- Blocked MT Simulation ----\n");
-	for(int k=0; k<threads; k++){
-		CORE_BlockedMT_CTX(blocked, k);
-	    printf("\nRegister file thread id %d:\n", k);
-	    for (int i=0; i<REGS_COUNT; ++i)
-            printf("\tR%d = 0x%X", i, blocked[k].reg[i]);
-	}
-    printf("\nBlocked MT CPI for this program %lf\n", CORE_BlockedMT_CPI());
-
-    // Start finegrained MT simulation
-	CORE_FinegrainedMT();
-	printf("\n-----Finegrained MT Simulation -----\n");
-	for(int k=0; k < SIM_GetThreadsNum(); k++){
-		CORE_FinegrainedMT_CTX(finegrained,k);
-	    printf("\nRegister file thread id %d:\n",k);
-	    for (int i = 0; i < REGS_COUNT; ++i)
-	        printf("\tR%d = 0x%X", i, finegrained[k].reg[i]);
-	}
-	printf("\nFinegrained Multithreading CPI for this program %lf\n\n", CORE_FinegrainedMT_CPI());
-	SIM_MemFree();
+	// the policy tables run on the image as it was loaded, the report below may write its data memory
+	SIM_Context *loaded = (policies || switchPolicies) ? SIM_CtxSnapshot(ctx) : NULL;
+	if ((policies || switchPolicies) && loaded == NULL) {
+		fprintf(stderr, "Failed initializing memory simulator!\n");
+		SIM_CtxFree(ctx);
+		exit(2);
+	}
 
-    // Free register files
-    free(blocked);
-    free(finegrained);
+    // Simulate blocked MT and finegrained MT, and SMT if asked
+	char *stats = NULL;
+	report_options options = {statsFname != NULL ? &stats : NULL, NULL, smtWidth, smtMemPorts, cached ? &cache : NULL,
+	                          bounded ? &memory : NULL, storeBuffer};
+	if (traceFname != NULL) {
+		options.trace = TRACE_Open(traceFname, traceFirst, traceLast);
+		if (options.trace == NULL) {
+			fprintf(stderr, "Failed opening %s\n", traceFname);
+			SIM_CtxFree(loaded);
+			SIM_CtxFree(ctx);
+			exit(2);
+		}
+	}
+	char *report = REPORT_RunWith(ctx, mode, &options);
+	if (options.trace != NULL && TRACE_Close(options.trace) != 0) {
+		fprintf(stderr, "Failed writing %s\n", traceFname);
+	}
+	if (report == NULL) {
+		fprintf(stderr, "Failed running the simulation!\n");
+		if (statsFname != NULL) {
+			fprintf(stderr, "Cycle accounting needs a build with SIM_STATS defined\n");
+		}
+		if (cached) {
+			fprintf(stderr, "The data cache needs sizes that are powers of 2, lines of 4 bytes or more and up to 64 ways\n");
+		}
+		SIM_CtxFree(loaded);
+		SIM_CtxFree(ctx);
+		exit(2);
+	}
+	fputs(report, stdout);
+	if (policies) {
+		char *table = REPORT_Policies(loaded, weights, weightsCount, &options);
+		if (table == NULL) {
+			fprintf(stderr, "Failed comparing the thread selection policies!\n");
+		} else {
+			fputs(table, stdout);
+		}
+		free(table);
+	}
+	if (switchPolicies) {
+		char *table = REPORT_SwitchPolicies(loaded, switchThreshold, &options);
+		if (table == NULL) {
+			fprintf(stderr, "Failed comparing the switch policies!\n");
+		} else {
+			fputs(table, stdout);
+		}
+		free(table);
+	}
+	if (stats != NULL) {
+		FILE *statsFile = fopen(statsFname, "w");
+		if (statsFile == NULL || fputs(stats, statsFile) < 0) {
+			fprintf(stderr, "Failed writing %s\n", statsFname);
+		}
+		if (statsFile != NULL) {
+			fclose(statsFile);
+		}
+	}
 
+	free(weights);
+	free(stats);
+	free(report);
+	SIM_CtxFree(loaded);
+	SIM_CtxFree(ctx);
 	return 0;
 }
-
-
@@ -0,0 +1,96 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+
+#ifndef MEMORY_QUEUE_H_
+#define MEMORY_QUEUE_H_
+
+#include "core_api.h"
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+/**
+ * the requests a core has in flight to the data memory: at most `outstanding` at once (the MSHRs) of which at
+ * most `bandwidth` start in the same cycle. requests start in the order they were issued, one that finds no free
+ * slot queues until one frees up. requests are never reordered, so the start of every request is known when it
+ * is issued and the thread is simply held for its queueing delay on top of its latency.
+ */
+class MemoryQueue{
+    int outstanding;
+    int bandwidth;
+    std::vector<long long> completions; // min-heap of the ticks in which the requests in flight complete
+    long long lastStart; // tick in which the last request started
+    int lastStartCount; // requests that started in it
+    std::vector<memory_stats> threadStats;
+
+    void popCompletion(){
+        pop_heap(completions.begin(), completions.end(), std::greater<long long>());
+        completions.pop_back();
+    }
+
+public:
+    MemoryQueue(): outstanding(0), bandwidth(0), lastStart(-1), lastStartCount(0){}
+
+    bool enabled() const{
+        return outstanding > 0;
+    }
+
+    /**
+     * @param config - requests in flight and started per cycle
+     * @param threads - threads of the core, the queueing delay is counted per thread
+     * @return false if either is below 1, the queue is left as it was
+     */
+    bool configure(const memory_config& config, int threads){
+        if (config.outstanding < 1 || config.bandwidth < 1)
+            return false;
+        outstanding = config.outstanding;
+        bandwidth = config.bandwidth;
+        completions.clear();
+        completions.reserve(outstanding); // so that runs do not allocate
+        lastStart = -1;
+        lastStartCount = 0;
+        memory_stats noStats = {0, 0};
+        threadStats.assign(threads, noStats);
+        return true;
+    }
+
+    /**
+     * issues a request, it starts once a slot is free and takes latency cycles from then on
+     * @param tick - tick in which the request is issued, no earlier than that of the request before
+     * @param threadNum - thread of the core making the request
+     * @return the cycles from tick until the request completes
+     */
+    int issue(long long tick, int latency, int threadNum){
+        long long start = std::max(tick, lastStart);
+        while (!completions.empty() && completions.front() <= start) // slots freed by then
+            popCompletion();
+        if ((int)completions.size() == outstanding){ // wait for the first request in flight
+            start = completions.front();
+            popCompletion();
+        }
+        if (start == lastStart && lastStartCount == bandwidth) // the cycle's bandwidth is used up
+            start++;
+        if (start == lastStart)
+            lastStartCount++;
+        else {
+            lastStart = start;
+            lastStartCount = 1;
+        }
+        completions.push_back(start + std::max(latency, 0));
+        push_heap(completions.begin(), completions.end(), std::greater<long long>());
+        memory_stats& stats = threadStats[threadNum];
+        stats.requests++;
+        stats.queueCycles += start - tick;
+        return (int)(start - tick) + latency;
+    }
+
+    /**
+     * @param threadNum - thread of the core to get
+     * @return the requests and queueing delay of the thread
+     */
+    const memory_stats& getThreadStats(int threadNum) const{
+        return threadStats[threadNum];
+    }
+};
+
+#endif /* MEMORY_QUEUE_H_ */
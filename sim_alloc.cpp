@@ -0,0 +1,93 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+/* Heap allocation accounting                          */
+
+#include "sim_alloc.h"
+
+#ifdef SIM_ALLOC_ACCOUNTING
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+static std::atomic<unsigned long> allocCount(0);
+static std::atomic<unsigned long long> allocBytes(0);
+static std::atomic<unsigned long> notedCount(0);
+
+/**
+ * counts an allocation of any kind
+ */
+static void countAlloc(size_t bytes){
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    allocBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void SIM_AllocNote(size_t bytes){
+    countAlloc(bytes);
+    notedCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+unsigned long SIM_AllocCount(){
+    return allocCount.load(std::memory_order_relaxed);
+}
+
+unsigned long long SIM_AllocBytes(){
+    return allocBytes.load(std::memory_order_relaxed);
+}
+
+unsigned long SIM_AllocNotedCount(){
+    return notedCount.load(std::memory_order_relaxed);
+}
+
+/**
+ * the allocation behind all the replaced forms of operator new
+ * @return the allocated block, NULL if out of memory
+ */
+static void* countedAlloc(size_t bytes){
+    countAlloc(bytes);
+    return malloc(bytes ? bytes : 1);
+}
+
+void* operator new(size_t bytes){
+    void* block = countedAlloc(bytes);
+    if (block == NULL)
+        throw std::bad_alloc();
+    return block;
+}
+
+void* operator new[](size_t bytes){
+    return operator new(bytes);
+}
+
+void* operator new(size_t bytes, const std::nothrow_t&) noexcept{
+    return countedAlloc(bytes);
+}
+
+void* operator new[](size_t bytes, const std::nothrow_t&) noexcept{
+    return countedAlloc(bytes);
+}
+
+void operator delete(void* block) noexcept{
+    free(block);
+}
+
+void operator delete[](void* block) noexcept{
+    free(block);
+}
+
+void operator delete(void* block, const std::nothrow_t&) noexcept{
+    free(block);
+}
+
+void operator delete[](void* block, const std::nothrow_t&) noexcept{
+    free(block);
+}
+
+void operator delete(void* block, size_t) noexcept{
+    free(block);
+}
+
+void operator delete[](void* block, size_t) noexcept{
+    free(block);
+}
+
+#endif
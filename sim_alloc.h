@@ -0,0 +1,47 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+
+#ifndef SIM_ALLOC_H_
+#define SIM_ALLOC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/*********************************************/
+/* Heap allocation accounting                */
+/*********************************************/
+/* Builds with SIM_ALLOC_ACCOUNTING defined count the heap allocations a simulation can make: sim_alloc.cpp replaces
+   the global operator new, and the memory simulator notes the data memory it allocates when a store needs a page.
+   Other builds count nothing. */
+
+#ifdef SIM_ALLOC_ACCOUNTING
+
+/*! SIM_AllocNote: Count a heap allocation made outside of operator new
+  \param[in] bytes Size of the allocation
+*/
+void SIM_AllocNote(size_t bytes);
+
+/*! SIM_AllocCount: Get the number of heap allocations counted since the process started */
+unsigned long SIM_AllocCount();
+
+/*! SIM_AllocBytes: Get the total size of the heap allocations counted since the process started */
+unsigned long long SIM_AllocBytes();
+
+/*! SIM_AllocNotedCount: Get the number of heap allocations counted by SIM_AllocNote, the rest were made by new */
+unsigned long SIM_AllocNotedCount();
+
+#define SIM_ALLOC_NOTE(bytes) SIM_AllocNote(bytes)
+
+#else
+
+#define SIM_ALLOC_NOTE(bytes) ((void)0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM_ALLOC_H_ */
@@ -1,7 +1,11 @@
 /* 046267 Computer Architecture - Spring 2020 - HW #4 */
 /* Main memory simulator implementation               */
 
+#define _POSIX_C_SOURCE 200809L // mmap, posix_madvise, pread, pthreads
+
 #include "core_api.h"
+#include "sim_api.h"
+#include "sim_alloc.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -9,279 +13,1303 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Data memory is a sparse two level table of 4 KiB pages over the 2^30 words of a 4 GiB address space.
+   Pages are allocated zero filled on the first write, unwritten memory reads as zero.
+   Snapshots of a context share its pages and copy a page only when one of them writes it. */
+#define PAGE_BITS 10
+#define TABLE_BITS 10
+#define DIR_BITS 10
+#define PAGE_WORDS (1 << PAGE_BITS)
+#define TABLE_PAGES (1 << TABLE_BITS)
+#define DIR_TABLES (1 << DIR_BITS)
+#define WORD_MASK ((1u << (PAGE_BITS + TABLE_BITS + DIR_BITS)) - 1)
+
+typedef struct {
+    int refs; // number of contexts sharing the page
+    int32_t words[PAGE_WORDS];
+} sim_page;
+
+typedef struct {
+    sim_page *pages[TABLE_PAGES];
+} sim_page_table;
+
+/* an instruction as it is kept in a program, and in a binary image */
+typedef struct {
+    uint8_t opcode;
+    uint8_t dst_index;
+    uint8_t src1_index;
+    uint8_t is_src2_imm;
+    int32_t src2_index_imm;
+} sim_inst;
+
+/* where the program of a thread lies in the program arena */
+typedef struct {
+    uint32_t start; // index of the thread's first instruction
+    uint32_t count; // number of instructions loaded for the thread
+} sim_thread_code;
 
-static const char *cmdStr[] = {"NOP", "ADD", "SUB","ADDI", "SUBI","LOAD", "STORE", "HALT"};
-uint32_t prog_start; // the addr of the code block
-uint32_t data_start; // the addr of the data block
-Instruction** instructions; // where the instructions are kept
-int32_t data[100]; // where the data is kept
-uint32_t ticks; // the current clk tick
-uint32_t read_tick; // the clk tick of the first attempt to read
-uint32_t write_tick;// the clk tick for write
-int load_store_latency[2];//load store
-int switch_; //the cycles that switch between cycles takes
-int threadnumber;
+typedef struct sim_stream sim_stream;
 
+/* the programs of all threads, shared by a context and its snapshots */
 typedef struct {
-    uint32_t addr;
-    int32_t val;
-    bool valid;
-    uint32_t ticks; // for LRU
-} cache_line;
+    const sim_inst *insts; // one arena holding the programs of all threads back to back
+    const sim_thread_code *code; // per thread
+    int inst_used;
+    int inst_cap;
+    int threads;
+    int cores; // number of cores the threads run on, at least 1
+    int *thread_core; // core of every thread, NULL if the threads are spread over the cores round robin
+    int refs; // number of contexts sharing the program
+    void *map; // the binary image insts and code point into, NULL if they were allocated
+    size_t map_len;
+    sim_stream *stream; // source of the instructions of a streamed program, whose insts is NULL
+} sim_program;
 
+/* Binary images hold a loaded context so it can be mapped back without parsing:
+   the header, a sim_thread_code per thread, the core of every thread if there is more than one core,
+   the packed instructions of all threads and the data pages that were written, every page as its first
+   word index followed by its words. All fields are 32 bit in host byte order.
+   Version 1 images have no cores field and a single core. */
+#define BIN_MAGIC "SIMB"
+#define BIN_VERSION 2
 
-uint32_t get_start(char *line) {
-    line = strtok(line, "\n");
-    strtok(line, "@");
-    line = strtok(NULL, "@");
-    return (uint32_t) strtol(line, NULL, 0);
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    int32_t load_store_latency[2];
+    int32_t switch_;
+    int32_t threads;
+    uint32_t prog_start;
+    uint32_t data_start;
+    uint32_t insts;
+    uint32_t data_pages;
+    int32_t cores;
+} bin_header;
+
+#define BIN_V1_HEADER offsetof(bin_header, cores)
+
+/* everything loaded from one memory image, so several simulations can live in one process */
+struct _sim_context {
+    uint32_t prog_start; // the addr of the code block
+    uint32_t data_start; // the addr of the data block
+    sim_program *program;
+    sim_page_table *data[DIR_TABLES]; // where the data is kept
+    int load_store_latency[2];//load store
+    int switch_; //the cycles that switch between cycles takes
+    int threadnumber;
+    int active_threads; // threads that are simulated, the first ones of the image
+};
+
+static SIM_Context *default_ctx; // the context behind the SIM_Mem* / SIM_Get* API
+
+
+/* index of the data word of an address, data is addressed relative to the last data block */
+static uint32_t data_word(const SIM_Context *ctx, uint32_t addr) {
+    int addr_i = addr - ctx->data_start;
+    addr_i = addr_i / 4; // addr is aligned to 4 byte
+    return (uint32_t)addr_i & WORD_MASK;
 }
 
-void get_data(char *line, int data_i) {
-    line = strtok(line, "\n");
-    data[data_i] = (int32_t) strtol(line, NULL, 0);
+/* the page holding a data word, NULL if it was never written */
+static sim_page *data_page(const SIM_Context *ctx, uint32_t word) {
+    sim_page_table *table = ctx->data[word >> (PAGE_BITS + TABLE_BITS)];
+    if (table == NULL) {
+        return NULL;
+    }
+    return table->pages[(word >> PAGE_BITS) & (TABLE_PAGES - 1)];
 }
 
-int get_dst(char *dst) {
-    strtok(dst, ",");
-    strtok(dst, "$");
-    dst = strtok(NULL, "$");
-    return atoi(dst);
+/* the location of a data word for writing, allocating or unsharing its page. NULL if out of memory */
+static int32_t *data_word_for_write(SIM_Context *ctx, uint32_t word) {
+    sim_page_table **table = &ctx->data[word >> (PAGE_BITS + TABLE_BITS)];
+    if (*table == NULL) {
+        *table = calloc(1, sizeof(**table));
+        SIM_ALLOC_NOTE(sizeof(**table));
+        if (*table == NULL) {
+            return NULL;
+        }
+    }
+    sim_page **page = &(*table)->pages[(word >> PAGE_BITS) & (TABLE_PAGES - 1)];
+    if (*page == NULL) {
+        *page = calloc(1, sizeof(**page));
+        SIM_ALLOC_NOTE(sizeof(**page));
+        if (*page == NULL) {
+            return NULL;
+        }
+        (*page)->refs = 1;
+    } else if (__atomic_load_n(&(*page)->refs, __ATOMIC_ACQUIRE) > 1) { // shared with a snapshot, copy on write
+        sim_page *copy = malloc(sizeof(*copy));
+        SIM_ALLOC_NOTE(sizeof(*copy));
+        if (copy == NULL) {
+            return NULL;
+        }
+        memcpy(copy->words, (*page)->words, sizeof(copy->words));
+        copy->refs = 1;
+        if (__atomic_sub_fetch(&(*page)->refs, 1, __ATOMIC_ACQ_REL) == 0) { // the other sharers let go meanwhile
+            free(*page);
+        }
+        *page = copy;
+    }
+    return &(*page)->words[word & (PAGE_WORDS - 1)];
+}
+
+/* true if the core can execute an instruction: a known opcode whose registers are all in the register file */
+static bool valid_inst(const sim_inst *inst) {
+    return inst->opcode <= CMD_HALT && inst->dst_index < REGS_COUNT && inst->src1_index < REGS_COUNT &&
+           inst->is_src2_imm <= 1 &&
+           (inst->is_src2_imm || (inst->src2_index_imm >= 0 && inst->src2_index_imm < REGS_COUNT));
+}
+
+/* the next free instruction of the program arena, growing it if needed. NULL if out of memory */
+static sim_inst *new_inst(sim_program *program) {
+    if (program->inst_used == program->inst_cap) {
+        int cap = program->inst_cap ? program->inst_cap * 2 : 256;
+        sim_inst *insts = realloc((sim_inst *)program->insts, sizeof(*insts) * cap);
+        if (insts == NULL) {
+            return NULL;
+        }
+        program->insts = insts;
+        program->inst_cap = cap;
+    }
+    return (sim_inst *)&program->insts[program->inst_used++];
 }
 
-int get_dst_br(char *dst) {
-    strtok(dst, "\n");
-    strtok(dst, "$");
-    dst = strtok(NULL, "$");
-    return atoi(dst);
+/*********************************************/
+/* Image parser                              */
+/*********************************************/
+/* The image is parsed in a single pass straight out of its (mapped) buffer: every line is
+   tokenized once where it lies, nothing is copied and the buffer need not be NUL terminated. */
+
+typedef struct {
+    const char *name; // image name for error messages
+    const char *pos; // start of the next line
+    const char *end;
+    int line_no; // number of the line returned last, from 1
+    const char *line; // the line returned last and its end (its '\n' or the buffer end)
+    const char *eol;
+} img_reader;
+
+/* moves to the next line, returns false at the end of the buffer */
+static bool next_line(img_reader *r) {
+    if (r->pos >= r->end) {
+        return false;
+    }
+    r->line = r->pos;
+    r->eol = memchr(r->pos, '\n', r->end - r->pos);
+    if (r->eol == NULL) {
+        r->eol = r->end;
+    }
+    r->pos = (r->eol < r->end) ? r->eol + 1 : r->end;
+    r->line_no++;
+    return true;
 }
 
-int get_src1(char *src1) {
-    strtok(src1, ",");
-    src1 = strtok(NULL, ",");
-    strtok(src1, "$");
-    src1 = strtok(NULL, "$");
-    return atoi(src1);
+static void parse_error(const img_reader *r, const char *at, const char *msg) {
+    fprintf(stderr, "%s:%d:%d: %s\n", r->name, r->line_no, (int)(at - r->line) + 1, msg);
 }
 
-int get_src2(char *src2) {
-    strtok(src2, ",");
-    strtok(NULL, ",");
-    src2 = strtok(NULL, ",");
-    strtok(src2, "$");
-    src2 = strtok(NULL, "$");
-    src2 = strtok(src2, "\n");
-    return atoi(src2);
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
 }
 
-int get_src2_imm(char *src2, int inst_num, int tid) {
-	instructions[tid][inst_num].isSrc2Imm = 0; //assert
-    strtok(src2, ",");
-    strtok(NULL, ",");
-    src2 = strtok(NULL, ",");
-    if (strchr(src2, '$') == NULL) {
-        strtok(src2, " ");
-        instructions[tid][inst_num].isSrc2Imm = 1;
-    } else {
-        strtok(src2, "$");
-        src2 = strtok(NULL, "$");
-        assert(instructions[tid][inst_num].isSrc2Imm == 0);
+/* true for lines that separate blocks: empty lines and comment lines */
+static bool is_separator(const img_reader *r) {
+    const char *c = r->line;
+    while (c < r->eol && c[0] == '\r') {
+        c++;
     }
-    src2 = strtok(src2, "\n");
-    if (strchr(src2, 'x') == NULL) {
-        return atoi(src2);
-    } else {
-        return (uint32_t) strtol(src2, NULL, 0);
-    }
-}
-
-void add_sub(char *line, int inst_num, int tid) {
-    char dst[50];
-    instructions[tid][inst_num].isSrc2Imm = 0;
-    memset(dst, '\0', sizeof(dst));
-    strcpy(dst, line);
-    instructions[tid][inst_num].dst_index = get_dst(dst);
-    char src1[50];
-    memset(src1, '\0', sizeof(src1));
-    strcpy(src1, line);
-    instructions[tid][inst_num].src1_index = get_src1(src1);
-    char src2[50];
-    memset(src2, '\0', sizeof(src2));
-    strcpy(src2, line);
-    instructions[tid][inst_num].src2_index_imm = get_src2_imm(src2, inst_num, tid);
-}
-
-void halt(char *line, int inst_num, int tid) {
-    char dst[50];
-    memset(dst, '\0', sizeof(dst));
-    strcpy(dst, line);
-    instructions[tid][inst_num].dst_index = get_dst(dst);
-    instructions[tid][inst_num].isSrc2Imm=0;
-    instructions[tid][inst_num].src1_index=0;
-    instructions[tid][inst_num].src2_index_imm=0;
-}
-
-
-void load_store(char *line, int inst_num, int tid) {
-    char dst[50];
-    memset(dst, '\0', sizeof(dst));
-    strcpy(dst, line);
-    instructions[tid][inst_num].dst_index = get_dst(dst);
-    char src1[50];
-    memset(src1, '\0', sizeof(src1));
-    strcpy(src1, line);
-    instructions[tid][inst_num].src1_index = get_src1(src1);
-    char src2[50];
-    memset(src2, '\0', sizeof(src2));
-    strcpy(src2, line);
-    instructions[tid][inst_num].src2_index_imm = get_src2_imm(src2, inst_num, tid);
-}
-
-
-void get_inst(char *line, int inst_num, int tid) {
-    char command[50];
-    memset(command, '\0', sizeof(command));
-    strcpy(command, line);
-    strtok(command, " ");
-    int opc = 0;
-    while (strcmp(command, cmdStr[opc]) != 0) {
-        ++opc;
-    }
-    instructions[tid][inst_num].opcode = opc;
-    switch (opc) {
-        case CMD_NOP: // NOP
-            break;
-        case CMD_ADDI:
-        case CMD_SUBI:
-            add_sub(line, inst_num, tid);
+    return c == r->eol || r->line[0] == '#';
+}
+
+/* strtol over [p, end), *stop is set to the first character that was not parsed */
+static long parse_long(const char *p, const char *end, int base, const char **stop) {
+    bool negative = false;
+    unsigned long value = 0;
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+    if ((base == 0 || base == 16) && end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        base = 16;
+        p += 2;
+    } else if (base == 0) {
+        base = (p < end && *p == '0') ? 8 : 10;
+    }
+    const char *digits = p;
+    for (; p < end; p++) {
+        int digit;
+        if (*p >= '0' && *p <= '9') {
+            digit = *p - '0';
+        } else if (*p >= 'a' && *p <= 'z') {
+            digit = *p - 'a' + 10;
+        } else if (*p >= 'A' && *p <= 'Z') {
+            digit = *p - 'A' + 10;
+        } else {
             break;
-        case CMD_ADD:
-        case CMD_SUB:
-            add_sub(line, inst_num, tid);
+        }
+        if (digit >= base) {
             break;
-        case CMD_LOAD:
-        case CMD_STORE:
-            load_store(line, inst_num, tid);
+        }
+        value = value * base + digit;
+    }
+    if (stop != NULL) {
+        *stop = (p == digits) ? NULL : p;
+    }
+    return negative ? -(long)value : (long)value;
+}
+
+/* the address of an "I@<address>" / "D@<address>" line */
+static uint32_t parse_start(const img_reader *r) {
+    return (uint32_t) parse_long(r->line + 2, r->eol, 0, NULL);
+}
+
+/* finds the next comma separated operand of [*p, end), returns its start and moves *p past it */
+static const char *next_operand(const char **p, const char *end, const char **op_end) {
+    const char *start = *p;
+    const char *comma = memchr(start, ',', end - start);
+    *op_end = (comma == NULL) ? end : comma;
+    *p = (comma == NULL) ? end : comma + 1;
+    return start;
+}
+
+/* a register operand "$<num>", returns false on a malformed or out of range register */
+static bool parse_reg(const img_reader *r, const char *op, const char *op_end, int *reg) {
+    const char *dollar = memchr(op, '$', op_end - op);
+    const char *stop;
+    if (dollar == NULL) {
+        parse_error(r, op, "expected a register");
+        return false;
+    }
+    long num = parse_long(dollar + 1, op_end, 10, &stop);
+    if (stop == NULL || num < 0 || num >= REGS_COUNT) {
+        parse_error(r, dollar, "bad register");
+        return false;
+    }
+    *reg = (int)num;
+    return true;
+}
+
+/* the second source operand, either a register "$<num>" or an immediate (decimal, or hex with "0x") */
+static bool parse_src2(const img_reader *r, const char *op, const char *op_end, Instruction *inst) {
+    if (memchr(op, '$', op_end - op) != NULL) {
+        inst->isSrc2Imm = 0;
+        return parse_reg(r, op, op_end, &inst->src2_index_imm);
+    }
+    const char *tok = op;
+    while (tok < op_end && is_space(*tok)) {
+        tok++;
+    }
+    const char *tok_end = tok;
+    while (tok_end < op_end && !is_space(*tok_end)) {
+        tok_end++;
+    }
+    const char *stop;
+    bool hex = memchr(tok, 'x', tok_end - tok) != NULL;
+    long imm = parse_long(tok, tok_end, hex ? 0 : 10, &stop);
+    if (stop == NULL) {
+        parse_error(r, tok, "expected a register or an immediate");
+        return false;
+    }
+    inst->isSrc2Imm = 1;
+    inst->src2_index_imm = (int)(uint32_t)imm;
+    return true;
+}
+
+/* decodes the opcode name at [p, end) from its first letter and length */
+static int parse_opcode(const char *p, const char *end) {
+    size_t len = end - p;
+    switch (p[0]) {
+        case 'N':
+            return (len == 3 && memcmp(p, "NOP", 3) == 0) ? CMD_NOP : -1;
+        case 'A':
+            if (len == 3 && memcmp(p, "ADD", 3) == 0) return CMD_ADD;
+            return (len == 4 && memcmp(p, "ADDI", 4) == 0) ? CMD_ADDI : -1;
+        case 'S':
+            if (len == 3 && memcmp(p, "SUB", 3) == 0) return CMD_SUB;
+            if (len == 4 && memcmp(p, "SUBI", 4) == 0) return CMD_SUBI;
+            return (len == 5 && memcmp(p, "STORE", 5) == 0) ? CMD_STORE : -1;
+        case 'L':
+            return (len == 4 && memcmp(p, "LOAD", 4) == 0) ? CMD_LOAD : -1;
+        case 'H':
+            return (len == 4 && memcmp(p, "HALT", 4) == 0) ? CMD_HALT : -1;
+    }
+    return -1;
+}
+
+/* parses the current line as "<command> <dst>,<src1>,<src2>", a '#' starts a comment */
+static bool parse_fields(const img_reader *r, Instruction *inst) {
+    const char *p = r->line;
+    const char *end = memchr(p, '#', r->eol - p);
+    if (end == NULL) {
+        end = r->eol;
+    }
+    const char *name_end = p;
+    while (name_end < end && !is_space(*name_end)) {
+        name_end++;
+    }
+    memset(inst, 0, sizeof(*inst));
+    int opc = (name_end > p) ? parse_opcode(p, name_end) : -1;
+    if (opc < 0) {
+        parse_error(r, p, "unknown instruction");
+        return false;
+    }
+    inst->opcode = opc;
+    if (opc == CMD_NOP) {
+        return true;
+    }
+    const char *op_end;
+    const char *op = next_operand(&name_end, end, &op_end);
+    if (!parse_reg(r, op, op_end, &inst->dst_index)) {
+        return false;
+    }
+    if (opc == CMD_HALT) {
+        return true;
+    }
+    if (name_end == end) {
+        parse_error(r, end, "missing operands");
+        return false;
+    }
+    op = next_operand(&name_end, end, &op_end);
+    if (!parse_reg(r, op, op_end, &inst->src1_index)) {
+        return false;
+    }
+    if (name_end == end) {
+        parse_error(r, end, "missing operands");
+        return false;
+    }
+    op = next_operand(&name_end, end, &op_end);
+    return parse_src2(r, op, op_end, inst);
+}
+
+/* parses the current line into a packed instruction */
+static bool parse_inst(const img_reader *r, sim_inst *packed) {
+    Instruction inst;
+    if (!parse_fields(r, &inst)) {
+        return false;
+    }
+    packed->opcode = (uint8_t)inst.opcode;
+    packed->dst_index = (uint8_t)inst.dst_index;
+    packed->src1_index = (uint8_t)inst.src1_index;
+    packed->is_src2_imm = inst.isSrc2Imm;
+    packed->src2_index_imm = inst.src2_index_imm;
+    return true;
+}
+
+/* parses a "C<cores> [<core of thread 0> <core of thread 1> ...]" line: the threads run on that many cores,
+   those not listed are spread over them round robin. the list needs the N line before it */
+static bool parse_cores(SIM_Context *ctx, const img_reader *r) {
+    sim_program *program = ctx->program;
+    const char *stop;
+    long cores = parse_long(r->line + 1, r->eol, 10, &stop);
+    if (stop == NULL || cores < 1 || cores > INT16_MAX) {
+        parse_error(r, r->line + 1, "bad number of cores");
+        return false;
+    }
+    free(program->thread_core);
+    program->thread_core = NULL;
+    program->cores = (int)cores;
+    for (int tid = 0; ; tid++) {
+        const char *p = stop;
+        long core = parse_long(p, r->eol, 10, &stop);
+        if (stop == NULL) {
             break;
-        case CMD_HALT:
-            halt(line, inst_num, tid);
+        }
+        if (tid >= program->threads || core < 0 || core >= cores) {
+            parse_error(r, p, tid >= program->threads ? "core of a thread out of range" : "core out of range");
+            return false;
+        }
+        if (program->thread_core == NULL) {
+            program->thread_core = malloc(program->threads * sizeof(*program->thread_core));
+            if (program->thread_core == NULL) {
+                return false;
+            }
+            for (int t = 0; t < program->threads; t++) {
+                program->thread_core[t] = t % program->cores;
+            }
+        }
+        program->thread_core[tid] = (int)core;
+    }
+    return true;
+}
+
+/* parses a whole image into ctx, returns false on error */
+static bool parse_image(SIM_Context *ctx, img_reader *r) {
+    sim_program *program = ctx->program;
+    int tid = 0;
+    bool has_line;
+
+    while ((has_line = next_line(r))) { // header: latencies up to the number of threads
+        if (is_separator(r)) {
+            continue;
+        }
+        int value = (int)parse_long(r->line + 1, r->eol, 10, NULL);
+        if (r->line[0] == 'S') {
+            ctx->load_store_latency[1] = value;
+        } else if (r->line[0] == 'L') {
+            ctx->load_store_latency[0] = value;
+        } else if (r->line[0] == 'O') {
+            ctx->switch_ = value;
+        } else if (r->line[0] == 'C') {
+            if (!parse_cores(ctx, r)) {
+                return false;
+            }
+        } else if (r->line[0] == 'N') {
+            if (value < 0) {
+                parse_error(r, r->line + 1, "bad number of threads");
+                return false;
+            }
+            ctx->threadnumber = value;
+            ctx->active_threads = value;
+            program->threads = value;
+            program->code = calloc(value, sizeof(*program->code));
+            if (value > 0 && program->code == NULL) {
+                return false;
+            }
             break;
+        }
+    }
+
+    while (next_line(r)) {
+        if (is_separator(r)) {
+            continue;
+        }
+        if (r->line[0] == 'C') {
+            if (!parse_cores(ctx, r)) {
+                return false;
+            }
+        } else if (r->line[0] == 'T') {
+            tid = (int)parse_long(r->line + 1, r->eol, 10, NULL);
+            if (tid < 0 || tid >= ctx->threadnumber) {
+                parse_error(r, r->line + 1, "thread id out of range");
+                return false;
+            }
+        } else if (r->eol - r->line >= 2 && r->line[0] == 'I' && r->line[1] == '@') { // start of code block
+            ctx->prog_start = parse_start(r);
+            int start = program->inst_used;
+            // a thread's latest code block replaces its earlier ones. the line that ends the block is skipped
+            while (next_line(r) && !is_separator(r) && r->line[0] != 'D') {
+                sim_inst *inst = new_inst(program);
+                if (inst == NULL || !parse_inst(r, inst)) {
+                    return false;
+                }
+            }
+            sim_thread_code *code = (sim_thread_code *)&program->code[tid];
+            code->start = start;
+            code->count = program->inst_used - start;
+        } else if (r->eol - r->line >= 2 && r->line[0] == 'D' && r->line[1] == '@') { // start of data block
+            ctx->data_start = parse_start(r);
+            uint32_t data_i = 0;
+            // every line up to a separator or a code block is a data word. the line that ends the block is skipped
+            while (next_line(r) && !is_separator(r) && r->line[0] != 'I') {
+                int32_t *word = data_word_for_write(ctx, data_i++ & WORD_MASK);
+                if (word == NULL) {
+                    return false;
+                }
+                *word = (int32_t) parse_long(r->line, r->eol, 0, NULL);
+            }
+        }
     }
+    return true;
 }
 
-int SIM_MemReset(const char *memImgFname) {
-    FILE *img = fopen(memImgFname, "r");
-    int tid;
-    char line[1024];
-    if (img == 0) {
-        return -1; // can't open img file
-    }
-    while (fgets(line, 1024, img) != NULL) {
-        if (line[0] == '#' || line[0] == '\n')   // comment or empty line
-        {
+/* creates a context and its program, NULL if out of memory */
+static SIM_Context *new_ctx() {
+    SIM_Context *ctx = calloc(1, sizeof(*ctx));
+    sim_program *program = calloc(1, sizeof(*program));
+    if (ctx == NULL || program == NULL) {
+        free(ctx);
+        free(program);
+        return NULL;
+    }
+    program->refs = 1;
+    program->cores = 1;
+    ctx->program = program;
+    return ctx;
+}
+
+SIM_Context *SIM_CtxCreateFromBuffer(const char *image, size_t len, const char *name) {
+    SIM_Context *ctx = new_ctx();
+    if (ctx == NULL) {
+        return NULL;
+    }
+    img_reader r = {name, image, image + len, 0, image, image};
+    if (!parse_image(ctx, &r)) {
+        SIM_CtxFree(ctx);
+        return NULL;
+    }
+    sim_program *program = ctx->program;
+    if (program->inst_used > 0 && program->inst_used < program->inst_cap) { // trim the arena to the program size
+        sim_inst *insts = realloc((sim_inst *)program->insts, sizeof(*insts) * program->inst_used);
+        if (insts != NULL) {
+            program->insts = insts;
+            program->inst_cap = program->inst_used;
+        }
+    }
+    return ctx;
+}
+
+SIM_Context *SIM_CtxCreateEmpty(int threads, int loadLat, int storeLat, int switchCycles) {
+    if (threads < 0) {
+        return NULL;
+    }
+    SIM_Context *ctx = new_ctx();
+    if (ctx == NULL) {
+        return NULL;
+    }
+    sim_program *program = ctx->program;
+    program->code = calloc(threads, sizeof(*program->code));
+    if (threads > 0 && program->code == NULL) {
+        SIM_CtxFree(ctx);
+        return NULL;
+    }
+    program->threads = threads;
+    ctx->threadnumber = threads;
+    ctx->active_threads = threads;
+    SIM_CtxSetParams(ctx, loadLat, storeLat, switchCycles);
+    return ctx;
+}
+
+int SIM_CtxAppendInst(SIM_Context *ctx, int tid, const Instruction *inst) {
+    sim_program *program = ctx->program;
+    if (tid < 0 || tid >= program->threads || program->map != NULL || program->stream != NULL || program->refs > 1) {
+        return -1;
+    }
+    sim_thread_code *code = (sim_thread_code *)&program->code[tid];
+    if (code->count == 0) {
+        code->start = program->inst_used;
+    } else if (code->start + code->count != (uint32_t)program->inst_used) { // another thread was appended since
+        return -1;
+    }
+    sim_inst checked = {(uint8_t)inst->opcode, (uint8_t)inst->dst_index, (uint8_t)inst->src1_index, inst->isSrc2Imm,
+                        inst->src2_index_imm};
+    if ((unsigned)inst->opcode > CMD_HALT || (unsigned)inst->dst_index >= REGS_COUNT ||
+        (unsigned)inst->src1_index >= REGS_COUNT || !valid_inst(&checked)) {
+        return -1;
+    }
+    sim_inst *packed = new_inst(program);
+    if (packed == NULL) {
+        return -1;
+    }
+    *packed = checked;
+    code->count++;
+    return 0;
+}
+
+/*********************************************/
+/* Streamed programs                         */
+/*********************************************/
+/* A streamed program keeps only a window of every thread's instructions in memory. Threads fetch their
+   lines in order, so a background thread reads the lines ahead of every thread from the binary image
+   into its ring buffer while the simulation runs. Fetching a line out of the window restarts the
+   thread's stream there, which is how a second simulation of the same context starts over. */
+
+#define STREAM_MIN_WINDOW 16
+#define STREAM_DEFAULT_WINDOW 4096
+
+typedef struct {
+    sim_inst *buf; // ring buffer, line l is kept at buf[l % window]
+    uint32_t window; // lines the ring buffer holds
+    uint32_t released; // the line the thread fetched last, lines before it may be overwritten
+    uint32_t tail; // lines [released, tail) are in buf
+    uint32_t gen; // bumped whenever the thread restarts its stream, so reads of the old stream are dropped
+    int wanted; // set by the thread when it asked for a refill, cleared by the background thread
+} stream_thread;
+
+struct sim_stream {
+    int fd;
+    uint64_t insts_offset; // of the instructions in the binary image
+    const sim_thread_code *code;
+    int threads;
+    stream_thread *thread;
+    pthread_mutex_t lock; // held for moving tail, restarting a stream and sleeping
+    pthread_cond_t refill; // signaled when a thread wants lines
+    pthread_cond_t filled; // signaled when lines were read
+    pthread_t reader;
+    bool stop;
+};
+
+/* reads lines [from, from + n) of a thread into its ring buffer, lines that can't be read become HALT */
+static void stream_fill(sim_stream *stream, int tid, uint32_t from, uint32_t n) {
+    stream_thread *th = &stream->thread[tid];
+    while (n > 0) {
+        uint32_t slot = from % th->window;
+        uint32_t chunk = (n < th->window - slot) ? n : th->window - slot;
+        char *dst = (char *)&th->buf[slot];
+        size_t left = chunk * sizeof(sim_inst);
+        off_t offset = (off_t)(stream->insts_offset + ((uint64_t)stream->code[tid].start + from) * sizeof(sim_inst));
+        while (left > 0) {
+            ssize_t got = pread(stream->fd, dst, left, offset);
+            if (got <= 0) {
+                fprintf(stderr, "failed reading the program of thread %d\n", tid);
+                for (char *end = dst + left; dst < end; dst += sizeof(sim_inst)) {
+                    sim_inst halt = {CMD_HALT, 0, 0, 0, 0};
+                    memcpy(dst, &halt, sizeof(halt));
+                }
+                break;
+            }
+            dst += got;
+            left -= got;
+            offset += got;
+        }
+        from += chunk;
+        n -= chunk;
+    }
+}
+
+/* the background thread: keeps topping up the thread with the fewest lines ahead of it */
+static void *stream_reader(void *arg) {
+    sim_stream *stream = arg;
+    pthread_mutex_lock(&stream->lock);
+    while (!stream->stop) {
+        int best = -1;
+        uint32_t best_ahead = 0, best_end = 0;
+        for (int tid = 0; tid < stream->threads; tid++) {
+            stream_thread *th = &stream->thread[tid];
+            __atomic_store_n(&th->wanted, 0, __ATOMIC_SEQ_CST);
+            uint32_t released = __atomic_load_n(&th->released, __ATOMIC_SEQ_CST);
+            uint32_t end = released + th->window;
+            if (end > stream->code[tid].count) {
+                end = stream->code[tid].count;
+            }
+            if (th->tail < end && (best < 0 || th->tail - released < best_ahead)) {
+                best = tid;
+                best_ahead = th->tail - released;
+                best_end = end;
+            }
+        }
+        if (best < 0) {
+            pthread_cond_wait(&stream->refill, &stream->lock);
             continue;
         }
-        if(line[0] == 'S') {
-        	load_store_latency[1]=atoi(&line[1]);
-        	continue;
+        stream_thread *th = &stream->thread[best];
+        uint32_t gen = th->gen, from = th->tail;
+        pthread_mutex_unlock(&stream->lock);
+        stream_fill(stream, best, from, best_end - from);
+        pthread_mutex_lock(&stream->lock);
+        if (th->gen == gen) { // the thread did not restart its stream meanwhile
+            __atomic_store_n(&th->tail, best_end, __ATOMIC_RELEASE);
+            pthread_cond_broadcast(&stream->filled);
         }
-        if(line[0] == 'L') {
-        	load_store_latency[0]=atoi(&line[1]);
-        	continue;
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
+
+/* frees a stream whose background thread is not running */
+static void stream_free(sim_stream *stream) {
+    for (int tid = 0; stream->thread != NULL && tid < stream->threads; tid++) {
+        free(stream->thread[tid].buf);
+    }
+    free(stream->thread);
+    close(stream->fd);
+    free(stream);
+}
+
+/* stops the background thread and frees the stream */
+static void stream_close(sim_stream *stream) {
+    if (stream == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&stream->lock);
+    stream->stop = true;
+    pthread_cond_signal(&stream->refill);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->reader, NULL);
+    pthread_cond_destroy(&stream->filled);
+    pthread_cond_destroy(&stream->refill);
+    pthread_mutex_destroy(&stream->lock);
+    stream_free(stream);
+}
+
+/* starts streaming the programs of a binary image, the stream owns fd (also on error). NULL if out of memory */
+static sim_stream *stream_open(int fd, uint64_t insts_offset, const sim_thread_code *code, int threads,
+                               uint32_t window) {
+    sim_stream *stream = calloc(1, sizeof(*stream));
+    if (stream == NULL) {
+        close(fd);
+        return NULL;
+    }
+    stream->fd = fd;
+    stream->insts_offset = insts_offset;
+    stream->code = code;
+    stream->threads = threads;
+    stream->thread = calloc(threads > 0 ? threads : 1, sizeof(*stream->thread));
+    bool ok = stream->thread != NULL;
+    for (int tid = 0; ok && tid < threads; tid++) {
+        stream_thread *th = &stream->thread[tid];
+        th->window = (code[tid].count < window) ? code[tid].count : window; // short programs take what they need
+        if (th->window == 0) {
+            th->window = 1;
+        }
+        th->buf = malloc(th->window * sizeof(sim_inst));
+        ok = th->buf != NULL;
+    }
+    if (!ok) {
+        stream_free(stream);
+        return NULL;
+    }
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->refill, NULL);
+    pthread_cond_init(&stream->filled, NULL);
+    if (pthread_create(&stream->reader, NULL, stream_reader, stream) != 0) {
+        pthread_cond_destroy(&stream->filled);
+        pthread_cond_destroy(&stream->refill);
+        pthread_mutex_destroy(&stream->lock);
+        stream_free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+/* a line that is not in the window of its thread: waits for it, restarting the stream there if needed */
+static void stream_wait(sim_stream *stream, stream_thread *th, uint32_t line) {
+    pthread_mutex_lock(&stream->lock);
+    if (line < th->released || line - th->released >= th->window) { // out of the window, restart at the line
+        th->gen++;
+        __atomic_store_n(&th->released, line, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&th->tail, line, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(&th->released, line, __ATOMIC_SEQ_CST);
+    }
+    pthread_cond_signal(&stream->refill);
+    while (__atomic_load_n(&th->tail, __ATOMIC_ACQUIRE) <= line) {
+        pthread_cond_wait(&stream->filled, &stream->lock);
+    }
+    pthread_mutex_unlock(&stream->lock);
+}
+
+/* reads a line of a thread, which must be within its program */
+static void stream_read(sim_stream *stream, int tid, uint32_t line, sim_inst *dst) {
+    stream_thread *th = &stream->thread[tid];
+    uint32_t released = __atomic_load_n(&th->released, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&th->tail, __ATOMIC_ACQUIRE);
+    if (line < released || line >= tail) {
+        stream_wait(stream, th, line);
+    } else if (line != released) {
+        __atomic_store_n(&th->released, line, __ATOMIC_SEQ_CST);
+        // ask for a refill once the thread is half way through its lines
+        if (tail < stream->code[tid].count && tail - line <= th->window / 2 &&
+            !__atomic_exchange_n(&th->wanted, 1, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_lock(&stream->lock);
+            pthread_cond_signal(&stream->refill);
+            pthread_mutex_unlock(&stream->lock);
+        }
+    }
+    *dst = th->buf[line % th->window];
+}
+
+/*********************************************/
+/* Binary images                             */
+/*********************************************/
+
+/* true if [offset, offset + size) lies within a buffer of len bytes */
+static bool in_bounds(uint64_t offset, uint64_t size, size_t len) {
+    return offset <= len && size <= len - offset;
+}
+
+/* unmaps a binary image that is no longer needed, and closes the file it was streamed from if any */
+static void drop_binary(void *map, size_t len, int stream_fd) {
+    munmap(map, len);
+    if (stream_fd >= 0) {
+        close(stream_fd);
+    }
+}
+
+/* creates a context over a mapped binary image. the layout of the image and its instructions are checked once,
+   so that a corrupt image cannot make the core index past its registers. NULL if the image is malformed.
+   if stream_fd is -1 the program keeps the image mapped and unmaps it when it is freed. otherwise the program
+   streams its instructions from stream_fd through windows of the given number of lines, and the image is unmapped
+   once the context is loaded. the image and stream_fd are released at once on error */
+static SIM_Context *load_binary(void *map, size_t len, const char *name, int stream_fd, uint32_t window) {
+    const bin_header *header = map;
+    if (len < BIN_V1_HEADER || (header->version != 1 && header->version != BIN_VERSION) || header->threads < 0 ||
+        (header->version == BIN_VERSION && (len < sizeof(*header) || header->cores < 1))) {
+        fprintf(stderr, "%s: unsupported binary image\n", name);
+        drop_binary(map, len, stream_fd);
+        return NULL;
+    }
+    int cores = (header->version == 1) ? 1 : header->cores;
+    uint64_t code_offset = (header->version == 1) ? BIN_V1_HEADER : sizeof(*header);
+    uint64_t cores_offset = code_offset + (uint64_t)header->threads * sizeof(sim_thread_code);
+    uint64_t insts_offset = cores_offset + (cores > 1 ? (uint64_t)header->threads * sizeof(int32_t) : 0);
+    uint64_t data_offset = insts_offset + (uint64_t)header->insts * sizeof(sim_inst);
+    uint64_t page_size = sizeof(uint32_t) + PAGE_WORDS * sizeof(int32_t);
+    if (!in_bounds(code_offset, insts_offset - code_offset, len) || !in_bounds(insts_offset, data_offset - insts_offset, len) ||
+        !in_bounds(data_offset, (uint64_t)header->data_pages * page_size, len)) {
+        fprintf(stderr, "%s: truncated binary image\n", name);
+        drop_binary(map, len, stream_fd);
+        return NULL;
+    }
+    const sim_thread_code *code = (const sim_thread_code *)((const char *)map + code_offset);
+    for (int tid = 0; tid < header->threads; tid++) {
+        if ((uint64_t)code[tid].start + code[tid].count > header->insts) {
+            fprintf(stderr, "%s: bad program of thread %d\n", name, tid);
+            drop_binary(map, len, stream_fd);
+            return NULL;
+        }
+    }
+    const sim_inst *insts = (const sim_inst *)((const char *)map + insts_offset);
+    for (uint32_t i = 0; i < header->insts; i++) {
+        if (!valid_inst(&insts[i])) {
+            fprintf(stderr, "%s: bad instruction %u\n", name, i);
+            drop_binary(map, len, stream_fd);
+            return NULL;
+        }
+    }
+    const int32_t *thread_core = (const int32_t *)((const char *)map + cores_offset);
+    for (int tid = 0; cores > 1 && tid < header->threads; tid++) {
+        if (thread_core[tid] < 0 || thread_core[tid] >= cores) {
+            fprintf(stderr, "%s: bad core of thread %d\n", name, tid);
+            drop_binary(map, len, stream_fd);
+            return NULL;
+        }
+    }
+
+    SIM_Context *ctx = new_ctx();
+    if (ctx == NULL) {
+        drop_binary(map, len, stream_fd);
+        return NULL;
+    }
+    ctx->prog_start = header->prog_start;
+    ctx->data_start = header->data_start;
+    ctx->load_store_latency[0] = header->load_store_latency[0];
+    ctx->load_store_latency[1] = header->load_store_latency[1];
+    ctx->switch_ = header->switch_;
+    ctx->threadnumber = header->threads;
+    ctx->active_threads = header->threads;
+    sim_program *program = ctx->program;
+    program->threads = header->threads;
+    program->inst_used = program->inst_cap = header->insts;
+    if (cores > 1 && SIM_CtxSetCores(ctx, cores, thread_core) != 0) {
+        SIM_CtxFree(ctx);
+        drop_binary(map, len, stream_fd);
+        return NULL;
+    }
+    if (stream_fd < 0) {
+        program->code = code;
+        program->insts = insts;
+        program->map = map; // from here on the program owns the mapping
+        program->map_len = len;
+    } else {
+        sim_thread_code *copy = malloc((header->threads > 0 ? header->threads : 1) * sizeof(*copy));
+        if (copy == NULL) {
+            SIM_CtxFree(ctx);
+            drop_binary(map, len, stream_fd);
+            return NULL;
+        }
+        memcpy(copy, code, header->threads * sizeof(*copy));
+        program->code = copy;
+        program->stream = stream_open(stream_fd, insts_offset, copy, header->threads, window);
+        if (program->stream == NULL) {
+            SIM_CtxFree(ctx);
+            munmap(map, len);
+            return NULL;
+        }
+    }
+
+    const char *page = (const char *)map + data_offset;
+    for (uint32_t p = 0; p < header->data_pages; p++, page += page_size) { // data pages are copied, they are written
+        uint32_t first;
+        memcpy(&first, page, sizeof(first));
+        int32_t *words = data_word_for_write(ctx, first & WORD_MASK & ~(PAGE_WORDS - 1));
+        if (words == NULL) {
+            SIM_CtxFree(ctx);
+            if (stream_fd >= 0) {
+                munmap(map, len);
+            }
+            return NULL;
+        }
+        memcpy(words, page + sizeof(first), PAGE_WORDS * sizeof(int32_t));
+    }
+    if (stream_fd >= 0) {
+        munmap(map, len);
+    }
+    return ctx;
+}
+
+int SIM_CtxSave(const SIM_Context *ctx, const char *fname) {
+    const sim_program *program = ctx->program;
+    if (program->stream != NULL) { // the instructions are not in memory
+        return -1;
+    }
+    bin_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BIN_MAGIC, sizeof(header.magic));
+    header.version = BIN_VERSION;
+    header.load_store_latency[0] = ctx->load_store_latency[0];
+    header.load_store_latency[1] = ctx->load_store_latency[1];
+    header.switch_ = ctx->switch_;
+    header.threads = ctx->threadnumber;
+    header.prog_start = ctx->prog_start;
+    header.data_start = ctx->data_start;
+    header.insts = program->inst_used;
+    header.cores = program->cores;
+    for (int t = 0; t < DIR_TABLES; t++) {
+        for (int p = 0; ctx->data[t] != NULL && p < TABLE_PAGES; p++) {
+            header.data_pages += (ctx->data[t]->pages[p] != NULL);
+        }
+    }
+
+    FILE *out = fopen(fname, "wb");
+    if (out == NULL) {
+        return -1;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(program->code, sizeof(*program->code), program->threads, out) == (size_t)program->threads;
+    for (int tid = 0; ok && program->cores > 1 && tid < program->threads; tid++) {
+        int32_t core = SIM_CtxGetThreadCore(ctx, tid);
+        ok = fwrite(&core, sizeof(core), 1, out) == 1;
+    }
+    ok = ok && fwrite(program->insts, sizeof(*program->insts), program->inst_used, out) == (size_t)program->inst_used;
+    for (int t = 0; ok && t < DIR_TABLES; t++) {
+        for (int p = 0; ok && ctx->data[t] != NULL && p < TABLE_PAGES; p++) {
+            const sim_page *page = ctx->data[t]->pages[p];
+            if (page == NULL) {
+                continue;
+            }
+            uint32_t first = ((uint32_t)t << (PAGE_BITS + TABLE_BITS)) | ((uint32_t)p << PAGE_BITS);
+            ok = fwrite(&first, sizeof(first), 1, out) == 1 &&
+                 fwrite(page->words, sizeof(page->words), 1, out) == 1;
+        }
+    }
+    if (fclose(out) != 0) {
+        ok = false;
+    }
+    return ok ? 0 : -1;
+}
+
+SIM_Context *SIM_CtxCreate(const char *memImgFname) {
+    int fd = open(memImgFname, O_RDONLY);
+    if (fd < 0) {
+        return NULL; // can't open img file
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    size_t len = (size_t)st.st_size;
+    if (len == 0) {
+        close(fd);
+        return SIM_CtxCreateFromBuffer("", 0, memImgFname);
+    }
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    if (len >= sizeof(bin_header) && memcmp(map, BIN_MAGIC, strlen(BIN_MAGIC)) == 0) { // binary image, mapped as is
+        return load_binary(map, len, memImgFname, -1, 0);
+    }
+    posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+    SIM_Context *ctx = SIM_CtxCreateFromBuffer(map, len, memImgFname);
+    munmap(map, len);
+    return ctx;
+}
+
+SIM_Context *SIM_CtxCreateStreamed(const char *binImgFname, int window) {
+    int fd = open(binImgFname, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(bin_header)) {
+        fprintf(stderr, "%s: not a binary image\n", binImgFname);
+        close(fd);
+        return NULL;
+    }
+    size_t len = (size_t)st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    if (memcmp(map, BIN_MAGIC, strlen(BIN_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a binary image\n", binImgFname);
+        drop_binary(map, len, fd);
+        return NULL;
+    }
+    if (window <= 0) {
+        window = STREAM_DEFAULT_WINDOW;
+    } else if (window < STREAM_MIN_WINDOW) {
+        window = STREAM_MIN_WINDOW;
+    }
+    return load_binary(map, len, binImgFname, fd, (uint32_t)window);
+}
+
+bool SIM_CtxIsStreamed(const SIM_Context *ctx) {
+    return ctx->program->stream != NULL;
+}
+
+/* a private copy of a streamed program with its own stream over the same image, NULL if out of memory */
+static sim_program *clone_streamed(const sim_program *program) {
+    sim_program *clone = calloc(1, sizeof(*clone));
+    sim_thread_code *code = malloc((program->threads > 0 ? program->threads : 1) * sizeof(*code));
+    int fd = dup(program->stream->fd);
+    if (clone == NULL || code == NULL || fd < 0) {
+        free(clone);
+        free(code);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    memcpy(code, program->code, program->threads * sizeof(*code));
+    *clone = *program;
+    clone->refs = 1;
+    clone->code = code;
+    if (program->thread_core != NULL) {
+        clone->thread_core = malloc(program->threads * sizeof(*clone->thread_core));
+        if (clone->thread_core == NULL) {
+            close(fd);
+            free(code);
+            free(clone);
+            return NULL;
         }
-        if(line[0] == 'O') {
-        	switch_=atoi(&line[1]);
-        	continue;
+        memcpy(clone->thread_core, program->thread_core, program->threads * sizeof(*clone->thread_core));
+    }
+    uint32_t window = 0;
+    for (int tid = 0; tid < program->threads; tid++) {
+        if (program->stream->thread[tid].window > window) {
+            window = program->stream->thread[tid].window;
         }
-        if(line[0] == 'N'){
-			threadnumber=atoi(&line[1]);
-			instructions = malloc(sizeof(*instructions)*threadnumber);
-			for(int i=0; i<threadnumber; i++){
-				instructions[i]=malloc(sizeof(instructions[i])*100);
-			}
-			break;
-		}
     }
+    clone->stream = stream_open(fd, program->stream->insts_offset, code, program->threads, window);
+    if (clone->stream == NULL) {
+        free(clone->thread_core);
+        free(code);
+        free(clone);
+        return NULL;
+    }
+    return clone;
+}
 
-    while (fgets(line, 1024, img) != NULL) {
-        if (line[0] == '#' || line[0] == '\n')   // comment or empty line
-        {
+SIM_Context *SIM_CtxSnapshot(const SIM_Context *ctx) {
+    SIM_Context *snapshot = malloc(sizeof(*snapshot));
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    *snapshot = *ctx;
+    for (int t = 0; t < DIR_TABLES; t++) { // page tables are private, pages are shared until written
+        if (ctx->data[t] == NULL) {
             continue;
         }
-        if(line[0] == 'T'){
-        	tid=atoi(&line[1]);
-        }
-        else if (line[0] == 'I' && line[1] == '@')     // start of code block
-        {
-            prog_start = get_start(line);
-            int inst = 0;
-            fgets(line, 1024, img);
-            // get next instructions
-            while (line[0] != '\n' && line[0] != '#' && line[0] != 'D') {
-                get_inst(line, inst, tid);
-                ++inst;
-                if (fgets(line, 1024, img) == NULL)   //EOF
-                {
-                    break;
-                }
+        snapshot->data[t] = malloc(sizeof(*snapshot->data[t]));
+        if (snapshot->data[t] == NULL) {
+            memset(&snapshot->data[t], 0, sizeof(snapshot->data) - t * sizeof(snapshot->data[0]));
+            snapshot->program = NULL;
+            SIM_CtxFree(snapshot);
+            return NULL;
+        }
+        *snapshot->data[t] = *ctx->data[t];
+        for (int p = 0; p < TABLE_PAGES; p++) {
+            if (ctx->data[t]->pages[p] != NULL) {
+                __atomic_add_fetch(&ctx->data[t]->pages[p]->refs, 1, __ATOMIC_RELAXED);
             }
-        } else if (line[0] == 'D' && line[1] == '@')     // start of data block
-        {
-            data_start = get_start(line);
-            int data_i = 0;
-            fgets(line, 1024, img);
-            while (line[0] != '\n' && line[0] != '#' && line[0] != 'I') {
-                get_data(line, data_i);
-                ++data_i;
-                if (fgets(line, 1024, img) == NULL) {
-                    break;
-                }
+        }
+    }
+    if (ctx->program->stream != NULL) { // a stream follows the fetches of one simulation, so it is not shared
+        snapshot->program = clone_streamed(ctx->program);
+        if (snapshot->program == NULL) {
+            SIM_CtxFree(snapshot);
+            return NULL;
+        }
+    } else {
+        __atomic_add_fetch(&ctx->program->refs, 1, __ATOMIC_RELAXED);
+    }
+    return snapshot;
+}
+
+void SIM_CtxFree(SIM_Context *ctx) {
+    if (ctx == NULL) {
+        return;
+    }
+    for (int t = 0; t < DIR_TABLES; t++) {
+        if (ctx->data[t] == NULL) {
+            continue;
+        }
+        for (int p = 0; p < TABLE_PAGES; p++) {
+            sim_page *page = ctx->data[t]->pages[p];
+            if (page != NULL && __atomic_sub_fetch(&page->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+                free(page);
             }
         }
+        free(ctx->data[t]);
+    }
+    sim_program *program = ctx->program;
+    if (program != NULL && __atomic_sub_fetch(&program->refs, 1, __ATOMIC_ACQ_REL) == 0) { // last context of the program
+        stream_close(program->stream);
+        if (program->map != NULL) {
+            munmap(program->map, program->map_len);
+        } else {
+            free((sim_inst *)program->insts);
+            free((sim_thread_code *)program->code);
+        }
+        free(program->thread_core);
+        free(program);
+    }
+	free(ctx);
+}
+
+void SIM_CtxMemDataRead(SIM_Context *ctx, uint32_t addr, int32_t *dst) {
+    uint32_t word = data_word(ctx, addr);
+    sim_page *page = data_page(ctx, word);
+    *dst = (page == NULL) ? 0 : page->words[word & (PAGE_WORDS - 1)];
+}
+
+void SIM_CtxMemDataWrite(SIM_Context *ctx, uint32_t addr, int32_t val) {
+    int32_t *word = data_word_for_write(ctx, data_word(ctx, addr));
+    assert(word != NULL);
+    *word = val;
+}
+
+void SIM_CtxMemInstRead(const SIM_Context *ctx, uint32_t line, Instruction *dst, int tid) {
+    const sim_program *program = ctx->program;
+    memset(dst, 0, sizeof(*dst));
+    if (line >= program->code[tid].count) { // past the end of the program
+        dst->opcode = CMD_HALT;
+        return;
     }
-    fclose(img);
+    sim_inst streamed;
+    const sim_inst *inst = &streamed;
+    if (program->stream != NULL) {
+        stream_read(program->stream, tid, line, &streamed);
+    } else {
+        inst = &program->insts[program->code[tid].start + line];
+    }
+    dst->opcode = (cmd_opcode)inst->opcode;
+    dst->dst_index = inst->dst_index;
+    dst->src1_index = inst->src1_index;
+    dst->src2_index_imm = inst->src2_index_imm;
+    dst->isSrc2Imm = inst->is_src2_imm;
+}
+
+int SIM_CtxGetLoadLat(const SIM_Context *ctx) {
+    return ctx->load_store_latency[0];
+}
+
+int SIM_CtxGetStoreLat(const SIM_Context *ctx) {
+    return ctx->load_store_latency[1];
+}
+
+int SIM_CtxGetSwitchCycles(const SIM_Context *ctx) {
+    return ctx->switch_;
+}
+
+int SIM_CtxGetThreadsNum(const SIM_Context *ctx) {
+	return ctx->active_threads;
+}
+
+void SIM_CtxSetParams(SIM_Context *ctx, int loadLat, int storeLat, int switchCycles) {
+    ctx->load_store_latency[0] = loadLat;
+    ctx->load_store_latency[1] = storeLat;
+    ctx->switch_ = switchCycles;
+}
+
+int SIM_CtxSetThreadsNum(SIM_Context *ctx, int threads) {
+    if (threads < 0 || threads > ctx->threadnumber) {
+        return -1;
+    }
+    ctx->active_threads = threads;
+    return 0;
+}
+
+int SIM_CtxGetInstCount(const SIM_Context *ctx, int tid) {
+	return (int)ctx->program->code[tid].count;
+}
+
+int SIM_CtxGetCoresNum(const SIM_Context *ctx) {
+    return ctx->program->cores;
+}
+
+int SIM_CtxGetThreadCore(const SIM_Context *ctx, int tid) {
+    const sim_program *program = ctx->program;
+    return (program->thread_core == NULL) ? tid % program->cores : program->thread_core[tid];
+}
+
+int SIM_CtxSetCores(SIM_Context *ctx, int cores, const int *threadCore) {
+    sim_program *program = ctx->program;
+    if (cores < 1 || cores > INT16_MAX) {
+        return -1;
+    }
+    for (int tid = 0; threadCore != NULL && tid < program->threads; tid++) {
+        if (threadCore[tid] < 0 || threadCore[tid] >= cores) {
+            return -1;
+        }
+    }
+    int *copy = NULL;
+    if (threadCore != NULL && program->threads > 0) {
+        copy = malloc(program->threads * sizeof(*copy));
+        if (copy == NULL) {
+            return -1;
+        }
+        memcpy(copy, threadCore, program->threads * sizeof(*copy));
+    }
+    free(program->thread_core);
+    program->thread_core = copy;
+    program->cores = cores;
+    return 0;
+}
+
+
+/* The original single image API, working on the default context */
+
+int SIM_MemReset(const char *memImgFname) {
+    SIM_Context *ctx = SIM_CtxCreate(memImgFname);
+    if (ctx == NULL) {
+        return -1;
+    }
+    SIM_CtxFree(default_ctx);
+    default_ctx = ctx;
     return 0;
 }
 
 void SIM_MemFree(){
-	for(int i=0; i<threadnumber; i++){
-		free(instructions[i]);
-	}
-	free(instructions);
+	SIM_CtxFree(default_ctx);
+	default_ctx = NULL;
+}
+
+SIM_Context *SIM_GetDefaultCtx() {
+    return default_ctx;
 }
 
 void SIM_MemDataRead(uint32_t addr, int32_t *dst) {
-    int addr_i = addr - data_start;
-    addr_i = addr_i / 4;
-    *dst = data[addr_i];
+    SIM_CtxMemDataRead(default_ctx, addr, dst);
 }
 
 void SIM_MemDataWrite(uint32_t addr, int32_t val) {
-    int addr_i = addr - data_start;
-    addr_i = addr_i / 4; // addr is aligned to 4 byte
-    data[addr_i] = val;
+    SIM_CtxMemDataWrite(default_ctx, addr, val);
 }
 
 void SIM_MemInstRead(uint32_t line, Instruction *dst, int tid) {
-    dst->opcode = instructions[tid][line].opcode;
-    dst->dst_index = instructions[tid][line].dst_index;
-    dst->src1_index = instructions[tid][line].src1_index;
-    dst->src2_index_imm = instructions[tid][line].src2_index_imm;
-    dst->isSrc2Imm = instructions[tid][line].isSrc2Imm;
+    SIM_CtxMemInstRead(default_ctx, line, dst, tid);
 }
 
 int SIM_GetLoadLat() {
-    return load_store_latency[0];
+    return SIM_CtxGetLoadLat(default_ctx);
 }
 
 int SIM_GetStoreLat() {
-    return load_store_latency[1];
+    return SIM_CtxGetStoreLat(default_ctx);
 }
 
 int SIM_GetThreadsNum() {
-	return threadnumber;
+	return SIM_CtxGetThreadsNum(default_ctx);
+}
+
+int SIM_GetInstCount(int tid) {
+	return SIM_CtxGetInstCount(default_ctx, tid);
 }
 
 int SIM_GetSwitchCycles() {
-    return switch_;
+    return SIM_CtxGetSwitchCycles(default_ctx);
 }
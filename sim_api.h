@@ -16,11 +16,122 @@ extern "C" {
 
 
 
+/*********************************************/
+/* The simulation context API                */
+/*********************************************/
+/* A SIM_Context holds everything loaded from one memory image: the per-thread programs,
+   the data memory and the simulator parameters. Contexts are independent of each other,
+   so any number of them may be simulated at once (one host thread per context).
+   The SIM_Mem* / SIM_Get* functions below work on a default context loaded by SIM_MemReset. */
+
+/*! SIM_CtxCreate: Load a memory image into a new context
+  \param[in] memImgFname Memory image filename, a text image (see SIM_MemReset for its format)
+                         or a binary image written by SIM_CtxSave
+  \returns the new context, NULL in case of error. Parse errors are reported to stderr with their line and column.
+*/
+SIM_Context *SIM_CtxCreate(const char *memImgFname);
+
+/*! SIM_CtxCreateFromBuffer: Load a memory image held in memory into a new context
+  \param[in] image The image text, it need not be NUL terminated and is not referenced after the call
+  \param[in] len Length of the image text
+  \param[in] name Name of the image in error messages
+  \returns the new context, NULL in case of error.
+*/
+SIM_Context *SIM_CtxCreateFromBuffer(const char *image, size_t len, const char *name);
+
+/*! SIM_CtxCreateEmpty: Create a context without an image, whose programs are built with SIM_CtxAppendInst
+  and whose data memory is set with SIM_CtxMemDataWrite
+  \param[in] threads Number of threads, all with empty programs
+  \param[in] loadLat, storeLat, switchCycles The parameters an image sets with L, S and O
+  \returns the new context, NULL in case of error.
+*/
+SIM_Context *SIM_CtxCreateEmpty(int threads, int loadLat, int storeLat, int switchCycles);
+
+/*! SIM_CtxAppendInst: Append an instruction to the program of a thread in a context from SIM_CtxCreateEmpty
+  \param[in] tid The thread id. A thread's program is kept in one piece, so it is built before the next
+                 thread is appended to.
+  \returns 0 - for success, <0 if the instruction has an unknown opcode or register, if the thread's program
+           was ended by appending to another thread, if the program is shared with a snapshot or in case of error.
+*/
+int SIM_CtxAppendInst(SIM_Context *ctx, int tid, const Instruction *inst);
+
+/*! SIM_CtxSave: Write a context as a binary image
+  \param[in] ctx The context to save: its parameters, the programs of all its threads and its data memory as it is now
+  \param[in] fname Image file to write. SIM_CtxCreate maps binary images back without parsing them.
+  \returns 0 - for success, <0 in case of error or if the context is streamed.
+*/
+int SIM_CtxSave(const SIM_Context *ctx, const char *fname);
+
+/*! SIM_CtxCreateStreamed: Load a binary image into a new context whose instructions are streamed
+  \param[in] binImgFname Binary image written by SIM_CtxSave
+  \param[in] window Number of lines of every thread to keep in memory, <=0 for the default.
+                    A background thread reads the lines ahead of every thread while it runs, so memory use
+                    is bounded by threads x window rather than by the program length.
+  \returns the new context, NULL in case of error. Threads should fetch their lines in order:
+           a line out of a thread's window restarts its stream there.
+*/
+SIM_Context *SIM_CtxCreateStreamed(const char *binImgFname, int window);
+
+/*! SIM_CtxIsStreamed: Check if the instructions of a context are streamed, see SIM_CtxCreateStreamed */
+bool SIM_CtxIsStreamed(const SIM_Context *ctx);
+
+/*! SIM_CtxSnapshot: Create a context over the same program with a private copy of the data memory
+  \param[in] ctx The context to copy. The snapshot holds its data memory as it is now,
+                 later writes to either context are not seen by the other.
+                 The snapshot of a streamed context streams the same image on its own.
+  \returns the new context, NULL in case of error. Contexts may be snapshot and freed from any thread.
+*/
+SIM_Context *SIM_CtxSnapshot(const SIM_Context *ctx);
+
+/*! SIM_CtxFree: Free a context and everything it holds */
+void SIM_CtxFree(SIM_Context *ctx);
+
+/* Context versions of the memory and parameter functions below */
+void SIM_CtxMemDataRead(SIM_Context *ctx, uint32_t addr, int32_t *dst);
+void SIM_CtxMemDataWrite(SIM_Context *ctx, uint32_t addr, int32_t val);
+void SIM_CtxMemInstRead(const SIM_Context *ctx, uint32_t line, Instruction *dst, int tid);
+int SIM_CtxGetLoadLat(const SIM_Context *ctx);
+int SIM_CtxGetStoreLat(const SIM_Context *ctx);
+int SIM_CtxGetSwitchCycles(const SIM_Context *ctx);
+int SIM_CtxGetThreadsNum(const SIM_Context *ctx);
+int SIM_CtxGetInstCount(const SIM_Context *ctx, int tid);
+
+/*! SIM_CtxSetParams: Override the latencies and switch overhead loaded from the image (L, S and O) */
+void SIM_CtxSetParams(SIM_Context *ctx, int loadLat, int storeLat, int switchCycles);
+
+/*! SIM_CtxSetThreadsNum: Simulate only the first threads of the image
+  \param[in] threads Number of threads to simulate, at most the N the image was loaded with
+  \returns 0 - for success, <0 if threads is out of range.
+*/
+int SIM_CtxSetThreadsNum(SIM_Context *ctx, int threads);
+
+/*! SIM_CtxGetCoresNum: Get the number of cores the threads run on, set by a "C<cores>" line of the image
+  after which the core of every thread may be listed ("C2 0 1 1 0"). 1 for images without it. */
+int SIM_CtxGetCoresNum(const SIM_Context *ctx);
+
+/*! SIM_CtxGetThreadCore: Get the core a thread runs on, threads the image does not place go round robin */
+int SIM_CtxGetThreadCore(const SIM_Context *ctx, int tid);
+
+/*! SIM_CtxSetCores: Override the cores loaded from the image. They belong to the program, which the
+  snapshots of the context share, so set them before taking snapshots.
+  \param[in] cores Number of cores
+  \param[in] threadCore Core of every thread of the image, NULL to spread the threads round robin
+  \returns 0 - for success, <0 if a value is out of range.
+*/
+int SIM_CtxSetCores(SIM_Context *ctx, int cores, const int *threadCore);
+
+/*! SIM_GetDefaultCtx: Get the context loaded by SIM_MemReset
+  \returns the default context, NULL if no image is loaded.
+*/
+SIM_Context *SIM_GetDefaultCtx();
+
+
+
 /*********************************************/
 /* The memory simulator API                  */
 /*********************************************/
 //freeing all the allocations
-int SIM_MemFree();
+void SIM_MemFree();
 
 /*! SIM_MemReset: Reset the memory simulator and load memory image
   \param[in] memImgFname Memory image filename
@@ -83,6 +194,12 @@ int SIM_GetSwitchCycles();
 */
 int SIM_GetThreadsNum();
 
+/*! SIM_GetInstCount: Get the number of instructions loaded for a thread
+  \param[in] tid The thread id
+  \param[out] number of instructions in the thread's program
+*/
+int SIM_GetInstCount(int tid);
+
 
 
 #ifdef __cplusplus
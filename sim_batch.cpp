@@ -0,0 +1,233 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+/* Parallel batch runner over test corpora             */
+
+#include "core_api.h"
+#include "sim_api.h"
+#include "sim_report.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+enum BatchStatus{
+    BATCH_PASS = 0,
+    BATCH_FAIL,
+    BATCH_NO_REF,   // image simulated, no expected output to compare with
+    BATCH_ERROR,    // image could not be loaded or simulated
+    BATCH_XFAIL,    // image failed as expected, see -x
+    BATCH_XPASS,    // image expected to fail matched its reference, the -x is stale
+};
+
+static const char* statusStr[] = {"PASS", "FAIL", "NOREF", "ERROR", "XFAIL", "XPASS"};
+
+/**
+ * an image of the batch together with its expected output and result
+ */
+struct BatchJob{
+    string image;
+    string expected; // expected output file, empty if there is none
+    bool expectFail; // listed with -x
+    BatchStatus status;
+    double ms; // wall time of loading and simulating the image
+};
+
+static bool fileExists(const string& path){
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static bool isDirectory(const string& path){
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static bool endsWith(const string& str, const string& suffix){
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool readFile(const string& path, string& content){
+    ifstream in(path.c_str(), ios::in | ios::binary);
+    if (!in)
+        return false;
+    ostringstream buf;
+    buf << in.rdbuf();
+    content = buf.str();
+    return true;
+}
+
+/**
+ * finds the expected output of an image: <stem>.out next to it, or <refDir>/<name>_output
+ * an .img image only takes <stem>.out if there is no <stem>.in, which is what .out files belong to
+ * @param image - image path
+ * @param refDir - directory of reference outputs, may be empty
+ * @return the expected output path, empty if there is none
+ */
+static string findExpected(const string& image, const string& refDir){
+    size_t dot = image.rfind('.');
+    string stem = image.substr(0, dot);
+    if (!endsWith(image, ".in") && fileExists(stem + ".in")) // the references next to it are of the .in image
+        return "";
+    if (fileExists(stem + ".out"))
+        return stem + ".out";
+    if (!refDir.empty()){
+        size_t slash = stem.rfind('/');
+        string name = (slash == string::npos) ? stem : stem.substr(slash + 1);
+        string ref = refDir + "/" + name + "_output";
+        if (fileExists(ref))
+            return ref;
+    }
+    return "";
+}
+
+/**
+ * adds the images of a path to the batch, directories contribute their .in and .img files
+ * @return false if the path does not exist
+ */
+static bool collectImages(const string& path, const string& refDir, const vector<string>& expectFail,
+                          vector<BatchJob>& jobs){
+    vector<string> images;
+    if (isDirectory(path)){
+        DIR* dir = opendir(path.c_str());
+        if (dir == NULL)
+            return false;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL){
+            string name = entry->d_name;
+            if (endsWith(name, ".in") || endsWith(name, ".img"))
+                images.push_back(path + "/" + name);
+        }
+        closedir(dir);
+        sort(images.begin(), images.end());
+    }
+    else if (fileExists(path)){
+        images.push_back(path);
+    }
+    else {
+        return false;
+    }
+    for (size_t i = 0; i < images.size(); i++){
+        bool expected = find(expectFail.begin(), expectFail.end(), images[i]) != expectFail.end();
+        BatchJob job = {images[i], findExpected(images[i], refDir), expected, BATCH_ERROR, 0};
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+/**
+ * loads, simulates and checks one image
+ */
+static void runJob(BatchJob& job, report_mode mode){
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    SIM_Context* ctx = SIM_CtxCreate(job.image.c_str());
+    char* report = REPORT_Run(ctx, mode);
+    SIM_CtxFree(ctx);
+    job.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    if (report == NULL){
+        job.status = BATCH_ERROR;
+        return;
+    }
+    string expected;
+    if (job.expected.empty())
+        job.status = BATCH_NO_REF;
+    else if (!readFile(job.expected, expected))
+        job.status = BATCH_ERROR;
+    else
+        job.status = (expected == report) ? BATCH_PASS : BATCH_FAIL;
+    if (job.status == BATCH_FAIL && job.expectFail)
+        job.status = BATCH_XFAIL;
+    else if (job.status == BATCH_PASS && job.expectFail)
+        job.status = BATCH_XPASS;
+    free(report);
+}
+
+static void usage(const char* prog){
+    fprintf(stderr, "usage: %s [-j threads] [-r reference dir] [-i] [-v] [-x image]... <image or directory>...\n", prog);
+    fprintf(stderr, "  images are compared against <stem>.out, or <reference dir>/<stem>_output\n");
+    fprintf(stderr, "  -i runs the two models independently, see sim_main --independent\n");
+    fprintf(stderr, "  -v prints every image with its wall time, not only the failing ones\n");
+    fprintf(stderr, "  -x expects an image, as it is named in the batch, to mismatch its reference, a match fails the batch\n");
+}
+
+int main(int argc, char const *argv[]){
+    int workers = thread::hardware_concurrency();
+    string refDir;
+    bool verbose = false;
+    report_mode mode = REPORT_SHARED_MEMORY;
+    vector<string> paths;
+    vector<string> expectFail;
+    for (int i = 1; i < argc; i++){
+        string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc)
+            workers = atoi(argv[++i]);
+        else if (arg == "-r" && i + 1 < argc)
+            refDir = argv[++i];
+        else if (arg == "-i")
+            mode = REPORT_INDEPENDENT;
+        else if (arg == "-v")
+            verbose = true;
+        else if (arg == "-x" && i + 1 < argc)
+            expectFail.push_back(argv[++i]);
+        else if (!arg.empty() && arg[0] == '-'){
+            usage(argv[0]);
+            return 1;
+        }
+        else
+            paths.push_back(arg);
+    }
+    if (paths.empty()){
+        usage(argv[0]);
+        return 1;
+    }
+    if (workers < 1)
+        workers = 1;
+
+    vector<BatchJob> jobs;
+    for (size_t i = 0; i < paths.size(); i++){
+        if (!collectImages(paths[i], refDir, expectFail, jobs)){
+            fprintf(stderr, "No such image or directory: %s\n", paths[i].c_str());
+            return 2;
+        }
+    }
+
+    // every worker takes the next image that was not taken yet
+    atomic<size_t> next(0);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<thread> pool;
+    for (int w = 0; w < workers; w++){
+        pool.push_back(thread([&jobs, &next, mode](){
+            for (size_t job = next++; job < jobs.size(); job = next++)
+                runJob(jobs[job], mode);
+        }));
+    }
+    for (size_t w = 0; w < pool.size(); w++)
+        pool[w].join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    int counts[6] = {0, 0, 0, 0, 0, 0};
+    for (size_t i = 0; i < jobs.size(); i++){
+        counts[jobs[i].status]++;
+        if (verbose || jobs[i].status == BATCH_FAIL || jobs[i].status == BATCH_ERROR || jobs[i].status == BATCH_XPASS)
+            printf("%-5s %s %.3f ms\n", statusStr[jobs[i].status], jobs[i].image.c_str(), jobs[i].ms);
+    }
+    printf("%zu images: %d passed, %d failed, %d without reference, %d errors",
+           jobs.size(), counts[BATCH_PASS], counts[BATCH_FAIL], counts[BATCH_NO_REF], counts[BATCH_ERROR]);
+    if (counts[BATCH_XFAIL])
+        printf(", %d expected failures", counts[BATCH_XFAIL]);
+    if (counts[BATCH_XPASS])
+        printf(", %d unexpected passes", counts[BATCH_XPASS]);
+    printf("\n");
+    printf("%.3f s on %d threads, %.1f images/s\n", seconds, workers, seconds > 0 ? jobs.size() / seconds : 0.0);
+    return (counts[BATCH_FAIL] || counts[BATCH_ERROR] || counts[BATCH_XPASS]) ? 1 : 0;
+}
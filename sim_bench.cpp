@@ -0,0 +1,524 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+/* Simulator speed benchmarks                          */
+
+#include "core_api.h"
+#include "sim_api.h"
+#include "sim_gen.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+static const char* threadProgram[] = {
+    "ADDI $1, $0, 0x4",
+    "LOAD $2, $1, 0x0",
+    "ADD $3, $2, $1",
+    "STORE $1, $3, 0x8",
+    "SUBI $4, $3, 0x1",
+    "LOAD $5, $0, $1",
+    "ADD $6, $5, $4",
+    "HALT $0",
+};
+static const int threadProgramLength = sizeof(threadProgram) / sizeof(threadProgram[0]);
+
+/**
+ * writes an image in which every thread runs the same short load/store program
+ * @param fname - image file to write
+ * @param threads - number of threads in the image
+ * @param loadLat - load latency of the image
+ * @param storeLat - store latency of the image
+ * @param switchCycles - context switch overhead of the image
+ * @return 0 on success, -1 if the file could not be written
+ */
+static int writeImage(const char* fname, int threads, int loadLat, int storeLat, int switchCycles){
+    FILE* img = fopen(fname, "w");
+    if (img == NULL)
+        return -1;
+    fprintf(img, "L%d\nS%d\nO%d\nN%d\n\n", loadLat, storeLat, switchCycles, threads);
+    for (int tid = 0; tid < threads; tid++){
+        fprintf(img, "T%d\nI@0x00000000\n", tid);
+        for (int i = 0; i < threadProgramLength; i++)
+            fprintf(img, "%s\n", threadProgram[i]);
+        fprintf(img, "\n");
+    }
+    fprintf(img, "D@0x00000000\n0x1\n0x2\n0x3\n0x4\n");
+    fclose(img);
+    return 0;
+}
+
+/**
+ * measures how the cost of a simulated cycle changes with the number of threads
+ * @param maxThreads - largest thread count to measure
+ */
+static int benchScheduler(int maxThreads){
+    char fname[] = "/tmp/sim_bench_XXXXXX";
+    int fd = mkstemp(fname);
+    if (fd < 0){
+        fprintf(stderr, "Failed creating a temporary image!\n");
+        return 2;
+    }
+    close(fd);
+
+    printf("%10s %12s %14s %14s %14s %14s\n", "threads", "instructions",
+           "blocked cyc", "blocked ns/cyc", "fg cyc", "fg ns/cyc");
+    for (int threads = 16; threads <= maxThreads; threads *= 4){
+        if (writeImage(fname, threads, 100, 50, 4) != 0 || SIM_MemReset(fname) != 0){
+            fprintf(stderr, "Failed initializing memory simulator!\n");
+            unlink(fname);
+            return 2;
+        }
+        double instructions = (double)threads * threadProgramLength;
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        CORE_BlockedMT();
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+        double blockedCycles = CORE_BlockedMT_CPI() * instructions;
+        double blockedNs = chrono::duration<double, nano>(end - start).count();
+
+        start = chrono::steady_clock::now();
+        CORE_FinegrainedMT();
+        end = chrono::steady_clock::now();
+        double fgCycles = CORE_FinegrainedMT_CPI() * instructions;
+        double fgNs = chrono::duration<double, nano>(end - start).count();
+
+        printf("%10d %12.0f %14.0f %14.2f %14.0f %14.2f\n", threads, instructions,
+               blockedCycles, blockedNs / blockedCycles, fgCycles, fgNs / fgCycles);
+        SIM_MemFree();
+    }
+    unlink(fname);
+    return 0;
+}
+
+static const int loadRepetitions = 5;
+
+/**
+ * @param fname - image to load
+ * @return the best wall time of loading the image, -1 if it could not be loaded
+ */
+static double timeLoad(const char* fname){
+    double best = -1;
+    for (int rep = 0; rep < loadRepetitions; rep++){
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        SIM_Context* ctx = SIM_CtxCreate(fname);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (ctx == NULL)
+            return -1;
+        SIM_CtxFree(ctx);
+        if (best < 0 || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+/**
+ * measures the loading speed of a large text image and of its binary image
+ * @param megabytes - approximate size of the image
+ */
+static int benchParse(int megabytes){
+    char fname[] = "/tmp/sim_bench_XXXXXX";
+    int fd = mkstemp(fname);
+    if (fd < 0){
+        fprintf(stderr, "Failed creating a temporary image!\n");
+        return 2;
+    }
+    close(fd);
+    // a few threads with long code blocks and a long data block, in the mix of the test images
+    int threads = 8;
+    long linesPerThread = (long)megabytes * 1024 * 1024 / 16 / (threads + 1) / threadProgramLength;
+    FILE* img = fopen(fname, "w");
+    if (img == NULL){
+        unlink(fname);
+        return 2;
+    }
+    fprintf(img, "L10\nS5\nO2\nN%d\n\n", threads);
+    for (int tid = 0; tid < threads; tid++){
+        fprintf(img, "T%d\nI@0x00000000\n", tid);
+        for (long i = 0; i < linesPerThread; i++)
+            for (int j = 0; j < threadProgramLength - 1; j++)
+                fprintf(img, "%s\n", threadProgram[j]);
+        fprintf(img, "HALT $0\n\n");
+    }
+    fprintf(img, "D@0x00000000\n");
+    for (long i = 0; i < linesPerThread * threadProgramLength; i++)
+        fprintf(img, "0x%lx\n", i & 0xffff);
+    long bytes = ftell(img);
+    fclose(img);
+
+    double textSeconds = timeLoad(fname);
+    char binFname[] = "/tmp/sim_bench_XXXXXX";
+    fd = mkstemp(binFname);
+    SIM_Context* ctx = (fd < 0) ? NULL : SIM_CtxCreate(fname);
+    bool saved = ctx != NULL && SIM_CtxSave(ctx, binFname) == 0;
+    SIM_CtxFree(ctx);
+    double binSeconds = saved ? timeLoad(binFname) : -1;
+    unlink(fname);
+    if (fd >= 0){
+        close(fd);
+        unlink(binFname);
+    }
+    if (textSeconds < 0 || binSeconds < 0){
+        fprintf(stderr, "Failed initializing memory simulator!\n");
+        return 2;
+    }
+    printf("%.1f MB text image: %.3f s, %.1f MB/s (best of %d)\n", bytes / 1048576.0, textSeconds,
+           bytes / 1048576.0 / textSeconds, loadRepetitions);
+    printf("binary image: %.6f s (best of %d)\n", binSeconds, loadRepetitions);
+    return 0;
+}
+
+/**
+ * @return resident memory of the process in MB, -1 if it is unknown
+ */
+static double residentMB(){
+    long pages, resident;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL)
+        return -1;
+    int fields = fscanf(statm, "%ld %ld", &pages, &resident);
+    fclose(statm);
+    return (fields == 2) ? resident * (double)sysconf(_SC_PAGESIZE) / 1048576 : -1;
+}
+
+/**
+ * simulates a binary image mapped as a whole and streamed, and reports the time and memory each takes
+ * @param binFname - binary image
+ * @param window - streaming window, lines per thread
+ */
+static int runStreamed(const char* binFname, int window){
+    printf("%10s %10s %12s %12s\n", "source", "window", "seconds", "resident MB");
+    for (int streamed = 0; streamed <= 1; streamed++){
+        double before = residentMB();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        SIM_Context* ctx = streamed ? SIM_CtxCreateStreamed(binFname, window) : SIM_CtxCreate(binFname);
+        CORE_Sim* sim = (ctx == NULL) ? NULL : CORE_Create(ctx, CORE_MODEL_BLOCKED);
+        if (sim == NULL){
+            fprintf(stderr, "Failed initializing memory simulator!\n");
+            SIM_CtxFree(ctx);
+            return 2;
+        }
+        CORE_Run(sim);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        double resident = residentMB() - before;
+        CORE_Destroy(sim);
+        SIM_CtxFree(ctx);
+        printf("%10s %10d %12.3f %12.1f\n", streamed ? "streamed" : "mapped", streamed ? window : 0, seconds, resident);
+    }
+    return 0;
+}
+
+/**
+ * measures streaming a long program against mapping it as a whole
+ * @param lines - program length of every thread
+ */
+static int benchStream(long lines){
+    char fname[] = "/tmp/sim_bench_XXXXXX";
+    char binFname[] = "/tmp/sim_bench_XXXXXX";
+    int fd = mkstemp(fname);
+    int binFd = mkstemp(binFname);
+    if (fd < 0 || binFd < 0){
+        fprintf(stderr, "Failed creating a temporary image!\n");
+        return 2;
+    }
+    close(fd);
+    close(binFd);
+    const int threads = 16;
+    FILE* img = fopen(fname, "w");
+    if (img == NULL)
+        return 2;
+    fprintf(img, "L10\nS5\nO2\nN%d\n\n", threads);
+    for (int tid = 0; tid < threads; tid++){
+        fprintf(img, "T%d\nI@0x00000000\n", tid);
+        for (long i = 0; i < lines; i++)
+            fprintf(img, "%s\n", threadProgram[i % (threadProgramLength - 1)]);
+        fprintf(img, "HALT $0\n\n");
+    }
+    fprintf(img, "D@0x00000000\n0x1\n0x2\n0x3\n0x4\n");
+    fclose(img);
+    SIM_Context* ctx = SIM_CtxCreate(fname);
+    bool saved = ctx != NULL && SIM_CtxSave(ctx, binFname) == 0;
+    SIM_CtxFree(ctx);
+    unlink(fname);
+    int ret = 2;
+    if (saved)
+        ret = runStreamed(binFname, 4096);
+    else
+        fprintf(stderr, "Failed initializing memory simulator!\n");
+    unlink(binFname);
+    return ret;
+}
+
+/**
+ * one configuration of the suite matrix
+ */
+struct SuiteConfig{
+    int threads;
+    int length; // instructions of every thread, with the HALT
+    const char* mix;
+    int memPercent; // loads and stores out of every 100 instructions
+    int loadLat;
+    int storeLat;
+};
+
+/**
+ * speed of a model in a configuration, over the repetitions
+ */
+struct SuiteResult{
+    string key; // model and configuration, as saved
+    double cyclesMean; // simulated cycles per second
+    double cyclesStddev;
+    double cyclesBest; // of the fastest repetition, the least disturbed by the host
+    double instsMean; // simulated instructions per second
+    double instsStddev;
+};
+
+static const int suiteThreads[] = {1, 4, 16, 64};
+static const int suiteLengths[] = {64, 4096};
+static const struct { const char* name; int memPercent; } suiteMixes[] = {{"alu", 0}, {"mixed", 25}, {"memory", 60}};
+static const int suiteLatencies[][2] = {{1, 1}, {10, 5}, {100, 50}};
+
+/**
+ * @return the workload of a configuration, every thread with its own sequence of the mix
+ */
+static gen_params suiteParams(const SuiteConfig& config){
+    gen_params params;
+    GEN_Defaults(&params);
+    params.threads = config.threads;
+    params.instructions = config.length;
+    params.memPercent = config.memPercent;
+    params.depPercent = 0;
+    params.footprint = 64;
+    params.loadLat = config.loadLat;
+    params.storeLat = config.storeLat;
+    return params;
+}
+
+static void meanStddev(const vector<double>& values, double& mean, double& stddev){
+    mean = 0;
+    for (size_t i = 0; i < values.size(); i++)
+        mean += values[i];
+    mean /= values.size();
+    double squares = 0;
+    for (size_t i = 0; i < values.size(); i++)
+        squares += (values[i] - mean) * (values[i] - mean);
+    stddev = values.size() > 1 ? sqrt(squares / (values.size() - 1)) : 0;
+}
+
+/**
+ * times CORE_Run of a model in a configuration. every repetition runs the simulation as many times as
+ * the first one needed to last minSeconds, only CORE_Run is timed
+ * @return false if the simulation could not be created
+ */
+static bool timeSuiteModel(SIM_Context* ctx, core_model model, double instructions, int reps, double minSeconds,
+                           SuiteResult& result){
+    vector<double> cyclesRates, instsRates;
+    long runs = 0;
+    for (int rep = 0; rep < reps; rep++){
+        double seconds = 0, cycles = 0;
+        for (long run = 0; runs == 0 ? seconds < minSeconds : run < runs; run++){
+            CORE_Sim* sim = CORE_Create(ctx, model);
+            if (sim == NULL)
+                return false;
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            CORE_Run(sim);
+            seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cycles += CORE_GetCPI(sim) * instructions;
+            CORE_Destroy(sim);
+            if (rep == 0 && seconds >= minSeconds)
+                runs = run + 1;
+        }
+        cyclesRates.push_back(cycles / seconds);
+        instsRates.push_back(instructions * runs / seconds);
+    }
+    meanStddev(cyclesRates, result.cyclesMean, result.cyclesStddev);
+    result.cyclesBest = *max_element(cyclesRates.begin(), cyclesRates.end());
+    meanStddev(instsRates, result.instsMean, result.instsStddev);
+    return true;
+}
+
+/**
+ * reads results saved by the suite
+ * @return false if the file could not be read
+ */
+static bool loadSuite(const char* fname, vector<SuiteResult>& results){
+    FILE* in = fopen(fname, "r");
+    if (in == NULL)
+        return false;
+    char line[256];
+    while (fgets(line, sizeof(line), in) != NULL){
+        char model[32], mix[32];
+        int threads, length, loadLat, storeLat;
+        SuiteResult result;
+        if (line[0] == '#' || sscanf(line, "%31s %d %d %31s %d %d %lf %lf %lf %lf %lf", model, &threads, &length, mix,
+                                     &loadLat, &storeLat, &result.cyclesMean, &result.cyclesStddev,
+                                     &result.cyclesBest, &result.instsMean, &result.instsStddev) != 11)
+            continue;
+        snprintf(line, sizeof(line), "%s %d %d %s %d %d", model, threads, length, mix, loadLat, storeLat);
+        result.key = line;
+        results.push_back(result);
+    }
+    fclose(in);
+    return true;
+}
+
+/**
+ * @return the saved result of the same model and configuration, NULL if there is none
+ */
+static const SuiteResult* findResult(const vector<SuiteResult>& results, const string& key){
+    for (size_t i = 0; i < results.size(); i++)
+        if (results[i].key == key)
+            return &results[i];
+    return NULL;
+}
+
+/**
+ * times both models over the suite matrix
+ * @param saveFname - file to save the results to, NULL to skip it
+ * @param compareFname - results of another build to compare to, NULL to skip it
+ * @param threshold - slowdown of the best simulated cycles per second, in percent, that is a regression when it is
+ *                    also beyond twice the combined standard deviation of both builds
+ * @return 0 on success, 1 if a regression was found, 2 on error
+ */
+static int benchSuite(int reps, double minSeconds, const char* saveFname, const char* compareFname, double threshold){
+    vector<SuiteResult> baseline;
+    if (compareFname != NULL && !loadSuite(compareFname, baseline)){
+        fprintf(stderr, "Failed reading %s\n", compareFname);
+        return 2;
+    }
+    FILE* save = NULL;
+    if (saveFname != NULL){
+        save = fopen(saveFname, "w");
+        if (save == NULL){
+            fprintf(stderr, "Failed writing %s\n", saveFname);
+            return 2;
+        }
+        fprintf(save, "# model threads length mix load store cycles/s stddev best-cycles/s insts/s stddev, %d repetitions\n",
+                reps);
+    }
+    printf("%-8s %7s %6s %-6s %4s %4s %12s %7s %12s %7s%s\n", "model", "threads", "length", "mix", "L", "S",
+           "Mcycles/s", "+-%", "Minsts/s", "+-%", compareFname != NULL ? "  vs baseline" : "");
+    int regressions = 0;
+    for (size_t t = 0; t < sizeof(suiteThreads) / sizeof(suiteThreads[0]); t++)
+    for (size_t l = 0; l < sizeof(suiteLengths) / sizeof(suiteLengths[0]); l++)
+    for (size_t m = 0; m < sizeof(suiteMixes) / sizeof(suiteMixes[0]); m++)
+    for (size_t lat = 0; lat < sizeof(suiteLatencies) / sizeof(suiteLatencies[0]); lat++){
+        SuiteConfig config = {suiteThreads[t], suiteLengths[l], suiteMixes[m].name, suiteMixes[m].memPercent,
+                              suiteLatencies[lat][0], suiteLatencies[lat][1]};
+        gen_params params = suiteParams(config);
+        SIM_Context* ctx = GEN_Create(&params);
+        if (ctx == NULL){
+            fprintf(stderr, "Failed initializing memory simulator!\n");
+            if (save != NULL)
+                fclose(save);
+            return 2;
+        }
+        double instructions = (double)config.threads * config.length;
+        for (int model = CORE_MODEL_BLOCKED; model <= CORE_MODEL_FINEGRAINED; model++){
+            SuiteResult result;
+            if (!timeSuiteModel(ctx, (core_model)model, instructions, reps, minSeconds, result)){
+                fprintf(stderr, "Failed initializing the core!\n");
+                SIM_CtxFree(ctx);
+                if (save != NULL)
+                    fclose(save);
+                return 2;
+            }
+            const char* modelName = (model == CORE_MODEL_BLOCKED) ? "blocked" : "fg";
+            char key[128];
+            snprintf(key, sizeof(key), "%s %d %d %s %d %d", modelName, config.threads, config.length, config.mix,
+                     config.loadLat, config.storeLat);
+            printf("%-8s %7d %6d %-6s %4d %4d %12.2f %7.1f %12.2f %7.1f", modelName, config.threads, config.length,
+                   config.mix, config.loadLat, config.storeLat, result.cyclesMean / 1e6,
+                   100 * result.cyclesStddev / result.cyclesMean, result.instsMean / 1e6,
+                   100 * result.instsStddev / result.instsMean);
+            const SuiteResult* base = findResult(baseline, key);
+            if (base != NULL){
+                double change = 100 * (result.cyclesBest / base->cyclesBest - 1);
+                double noise = 2 * sqrt(result.cyclesStddev * result.cyclesStddev +
+                                        base->cyclesStddev * base->cyclesStddev);
+                bool regressed = change < -threshold && base->cyclesBest - result.cyclesBest > noise;
+                printf("  %+6.1f%%%s", change, regressed ? " REGRESSION" : "");
+                regressions += regressed;
+            }
+            else if (compareFname != NULL){
+                printf("  no baseline");
+            }
+            printf("\n");
+            if (save != NULL)
+                fprintf(save, "%s %.6e %.6e %.6e %.6e %.6e\n", key, result.cyclesMean, result.cyclesStddev,
+                        result.cyclesBest, result.instsMean, result.instsStddev);
+        }
+        SIM_CtxFree(ctx);
+    }
+    if (save != NULL && fclose(save) != 0){
+        fprintf(stderr, "Failed writing %s\n", saveFname);
+        return 2;
+    }
+    if (compareFname != NULL)
+        printf("%d regressions beyond %.1f%% and the noise\n", regressions, threshold);
+    return regressions ? 1 : 0;
+}
+
+/**
+ * parses the options of the suite mode
+ */
+static int runSuite(int argc, char const *argv[], const char* prog){
+    int reps = 5;
+    double minSeconds = 0.01;
+    const char* saveFname = NULL;
+    const char* compareFname = NULL;
+    double threshold = 5;
+    for (int i = 0; i < argc; i++){
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--reps") == 0 && hasValue)
+            reps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--min-ms") == 0 && hasValue)
+            minSeconds = atof(argv[++i]) / 1000;
+        else if (strcmp(argv[i], "--save") == 0 && hasValue)
+            saveFname = argv[++i];
+        else if (strcmp(argv[i], "--compare") == 0 && hasValue)
+            compareFname = argv[++i];
+        else if (strcmp(argv[i], "--threshold") == 0 && hasValue)
+            threshold = atof(argv[++i]);
+        else
+            reps = 0;
+    }
+    if (reps < 1 || minSeconds <= 0 || threshold < 0){
+        fprintf(stderr, "usage: %s suite [--reps n] [--min-ms ms] [--save file] [--compare file] [--threshold %%]\n", prog);
+        return 1;
+    }
+    return benchSuite(reps, minSeconds, saveFname, compareFname, threshold);
+}
+
+static void usage(const char* prog){
+    fprintf(stderr, "usage: %s sched [max threads]\n", prog);
+    fprintf(stderr, "       %s parse [image MB]\n", prog);
+    fprintf(stderr, "       %s stream [lines per thread]\n", prog);
+    fprintf(stderr, "       %s suite [--reps n] [--min-ms ms] [--save file] [--compare file] [--threshold %%]\n", prog);
+    fprintf(stderr, "  suite times both models over threads x length x load/store mix x latencies,\n");
+    fprintf(stderr, "  --compare flags configurations slower than in the saved results of another build\n");
+}
+
+int main(int argc, char const *argv[]){
+    if (argc < 2){
+        usage(argv[0]);
+        return 1;
+    }
+    string mode = argv[1];
+    if (mode == "sched")
+        return benchScheduler(argc > 2 ? atoi(argv[2]) : 65536);
+    if (mode == "parse")
+        return benchParse(argc > 2 ? atoi(argv[2]) : 64);
+    if (mode == "stream")
+        return benchStream(argc > 2 ? atol(argv[2]) : 1000000);
+    if (mode == "suite")
+        return runSuite(argc - 2, argv + 2, argv[0]);
+    usage(argv[0]);
+    return 1;
+}
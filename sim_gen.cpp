@@ -0,0 +1,175 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+/* Synthetic workload generator                        */
+
+#include "sim_gen.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+static const char* opcodeStr[] = {"NOP", "ADD", "SUB", "ADDI", "SUBI", "LOAD", "STORE", "HALT"};
+
+/**
+ * splitmix64, the random stream of one thread of a workload
+ */
+class GenRandom{
+    uint64_t state;
+public:
+    GenRandom(unsigned long long seed, int tid) : state(seed ^ ((uint64_t)(tid + 1) * 0x9e3779b97f4a7c15ull)){}
+
+    uint64_t next(){
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+    /**
+     * @return a number in [0, n)
+     */
+    uint32_t below(uint32_t n){
+        return (uint32_t)((next() >> 32) * n >> 32);
+    }
+};
+
+/**
+ * draws the instructions of one thread. every program ends with a HALT, register 0 is never written so
+ * LOADs and STOREs address the footprint relative to it
+ */
+class ThreadGen{
+    const gen_params& params;
+    GenRandom random;
+    long line;
+    int lastDst; // destination of the instruction before, 0 if it had none
+public:
+    ThreadGen(const gen_params& params, int tid) : params(params), random(params.seed, tid), line(0), lastDst(0){}
+
+    /**
+     * @return false after the HALT
+     */
+    bool next(Instruction& inst){
+        if (line == params.instructions)
+            return false;
+        inst = Instruction();
+        if (++line == params.instructions){
+            inst.opcode = CMD_HALT;
+            return true;
+        }
+        bool mem = random.below(100) < (uint32_t)params.memPercent;
+        bool dependent = lastDst != 0 && random.below(100) < (uint32_t)params.depPercent;
+        int src = dependent ? lastDst : (int)random.below(REGS_COUNT);
+        if (mem && random.below(100) < (uint32_t)params.storePercent){
+            inst.opcode = CMD_STORE; // Mem[$0 + imm] <- src
+            inst.dst_index = 0;
+            inst.src1_index = src;
+            lastDst = 0;
+        }
+        else if (mem){
+            inst.opcode = CMD_LOAD; // dst <- Mem[$0 + imm]
+            inst.dst_index = 1 + random.below(REGS_COUNT - 1);
+            inst.src1_index = 0;
+            lastDst = inst.dst_index;
+        }
+        else {
+            inst.opcode = (cmd_opcode)(CMD_ADD + random.below(4));
+            inst.dst_index = 1 + random.below(REGS_COUNT - 1);
+            inst.src1_index = src;
+            lastDst = inst.dst_index;
+        }
+        if (mem){
+            inst.isSrc2Imm = true;
+            inst.src2_index_imm = (int)(4 * random.below(params.footprint));
+        }
+        else {
+            inst.isSrc2Imm = inst.opcode == CMD_ADDI || inst.opcode == CMD_SUBI;
+            inst.src2_index_imm = inst.isSrc2Imm ? (int)random.below(256) : (int)random.below(REGS_COUNT);
+        }
+        return true;
+    }
+};
+
+/**
+ * @return the initial value of a data word
+ */
+static int32_t dataWord(const gen_params& params, uint32_t word){
+    GenRandom random(params.seed ^ word, -2);
+    return (int32_t)random.next();
+}
+
+static bool validParams(const gen_params* params){
+    return params->threads >= 0 && params->instructions >= 1 && params->instructions <= UINT32_MAX &&
+           (double)params->threads * params->instructions <= INT32_MAX &&
+           params->memPercent >= 0 && params->memPercent <= 100 &&
+           params->storePercent >= 0 && params->storePercent <= 100 &&
+           params->depPercent >= 0 && params->depPercent <= 100 &&
+           (params->footprint > 0 || params->memPercent == 0) &&
+           params->footprint <= (1u << 29); // the byte offsets of the words fit an immediate
+}
+
+void GEN_Defaults(gen_params *params){
+    params->seed = 1;
+    params->threads = 4;
+    params->instructions = 100;
+    params->memPercent = 25;
+    params->storePercent = 33;
+    params->depPercent = 30;
+    params->footprint = 1024;
+    params->loadLat = 10;
+    params->storeLat = 5;
+    params->switchCycles = 2;
+}
+
+SIM_Context *GEN_Create(const gen_params *params){
+    if (!validParams(params))
+        return NULL;
+    SIM_Context* ctx = SIM_CtxCreateEmpty(params->threads, params->loadLat, params->storeLat, params->switchCycles);
+    if (ctx == NULL)
+        return NULL;
+    for (int tid = 0; tid < params->threads; tid++){
+        ThreadGen gen(*params, tid);
+        Instruction inst;
+        while (gen.next(inst)){
+            if (SIM_CtxAppendInst(ctx, tid, &inst) != 0){
+                SIM_CtxFree(ctx);
+                return NULL;
+            }
+        }
+    }
+    for (uint32_t word = 0; word < params->footprint; word++)
+        SIM_CtxMemDataWrite(ctx, 4 * word, dataWord(*params, word));
+    return ctx;
+}
+
+int GEN_WriteImage(const gen_params *params, const char *fname){
+    if (!validParams(params))
+        return -1;
+    FILE* img = fopen(fname, "w");
+    if (img == NULL)
+        return -1;
+    fprintf(img, "# generated: seed %llu, %ld instructions per thread, %d%% memory, %d%% stores, %d%% dependent\n",
+            params->seed, params->instructions, params->memPercent, params->storePercent, params->depPercent);
+    fprintf(img, "L%d\nS%d\nO%d\nN%d\n\n", params->loadLat, params->storeLat, params->switchCycles, params->threads);
+    for (int tid = 0; tid < params->threads; tid++){
+        fprintf(img, "T%d\nI@0x00000000\n", tid);
+        ThreadGen gen(*params, tid);
+        Instruction inst;
+        while (gen.next(inst)){
+            if (inst.opcode == CMD_HALT)
+                fprintf(img, "HALT $0\n");
+            else if (inst.isSrc2Imm)
+                fprintf(img, "%s $%d, $%d, 0x%x\n", opcodeStr[inst.opcode], inst.dst_index, inst.src1_index,
+                        inst.src2_index_imm);
+            else
+                fprintf(img, "%s $%d, $%d, $%d\n", opcodeStr[inst.opcode], inst.dst_index, inst.src1_index,
+                        inst.src2_index_imm);
+        }
+        fprintf(img, "\n");
+    }
+    if (params->footprint > 0){
+        fprintf(img, "D@0x00000000\n");
+        for (uint32_t word = 0; word < params->footprint; word++)
+            fprintf(img, "0x%x\n", (uint32_t)dataWord(*params, word));
+    }
+    bool failed = ferror(img) != 0;
+    if (fclose(img) != 0 || failed)
+        return -1;
+    return 0;
+}
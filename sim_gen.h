@@ -0,0 +1,51 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+
+#ifndef SIM_GEN_H_
+#define SIM_GEN_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "core_api.h"
+#include "sim_api.h"
+
+/*********************************************/
+/* Synthetic workloads                       */
+/*********************************************/
+/* Generated images have the same programs and data however they are produced, as a text image or
+   straight into a context. Every thread draws its program from its own random stream, seeded by the
+   seed and the thread id, so an image is determined by its parameters alone. */
+
+typedef struct {
+	unsigned long long seed;
+	int threads;
+	long instructions; // per thread, with the HALT that ends every program
+	int memPercent; // LOADs and STOREs out of every 100 instructions
+	int storePercent; // STOREs out of every 100 LOADs and STOREs
+	int depPercent; // instructions out of every 100 whose first source is the destination of the one before
+	uint32_t footprint; // data words, at most 2^29, all initialized and addressed uniformly by the LOADs and STOREs
+	int loadLat;
+	int storeLat;
+	int switchCycles;
+} gen_params;
+
+/*! GEN_Defaults: Set the parameters of a small mixed workload */
+void GEN_Defaults(gen_params *params);
+
+/*! GEN_Create: Generate a workload straight into a new context, without an image
+  \returns the new context, NULL if the parameters are out of range or in case of error.
+*/
+SIM_Context *GEN_Create(const gen_params *params);
+
+/*! GEN_WriteImage: Write a workload as a text memory image
+  \param[in] fname Image file to write
+  \returns 0 - for success, <0 if the parameters are out of range or the file could not be written.
+*/
+int GEN_WriteImage(const gen_params *params, const char *fname);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM_GEN_H_ */
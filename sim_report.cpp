@@ -0,0 +1,428 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+/* Textual results of a simulation                     */
+
+#include "sim_report.h"
+#include "sim_api.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * printf into the end of a string
+ * @param out - string to append to
+ * @param format - printf format
+ */
+static void appendf(string& out, const char* format, ...){
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len < (int)sizeof(buf)){
+        out.append(buf, len);
+        return;
+    }
+    vector<char> big(len + 1);
+    va_start(args, format);
+    vsnprintf(&big[0], big.size(), format, args);
+    va_end(args);
+    out.append(&big[0], len);
+}
+
+/**
+ * appends a ratio as a JSON number, null if it is not a number
+ */
+static void appendRatio(string& out, const char* name, double num, double den){
+    double ratio = num / den;
+    if (isfinite(ratio))
+        appendf(out, "\"%s\": %.6f", name, ratio);
+    else
+        appendf(out, "\"%s\": null", name);
+}
+
+/**
+ * appends the cycle accounting of a finished simulation as a JSON object
+ * @return false if the build does not collect stats
+ */
+static bool appendStats(CORE_Sim* sim, int threads, string& json){
+    core_stats core;
+    if (CORE_GetStats(sim, &core) != 0)
+        return false;
+    appendf(json, "{\"cycles\": %.0f, \"instructions\": %.0f, ", core.cycles, core.instructions);
+    appendRatio(json, "cpi", core.cycles, core.instructions);
+    appendf(json, ", \"exec_cycles\": %.0f, \"switch_cycles\": %.0f, \"idle_cycles\": %.0f, \"threads\": [",
+            core.execCycles, core.switchCycles, core.idleCycles);
+    for (int k = 0; k < threads; k++){
+        thread_stats thread;
+        CORE_GetThreadStats(sim, k, &thread);
+        appendf(json, "%s\n    {\"tid\": %d, \"instructions\": %.0f, \"load_stall_cycles\": %.0f, "
+                "\"store_stall_cycles\": %.0f, \"halt_cycle\": %.0f, ", k ? "," : "", k, thread.instructions,
+                thread.loadStallCycles, thread.storeStallCycles, thread.haltCycle);
+        appendRatio(json, "ipc", thread.instructions, core.cycles);
+        appendf(json, "}");
+    }
+    appendf(json, "%s]}", threads ? "\n  " : "");
+    return true;
+}
+
+/**
+ * what a report is made of: one of the core models, with the issue of SMT and the data cache of the cores
+ */
+struct ReportModel{
+    core_model model;
+    int width;
+    int memPorts;
+    const cache_config* cache; // NULL for none
+    const memory_config* memory; // NULL for unbounded
+    int storeBuffer; // >0 for scoreboard mode with this many store buffer entries
+};
+
+/**
+ * @return hits over accesses, 0 if there were none
+ */
+static double hitRate(double hits, double accesses){
+    return accesses > 0 ? hits / accesses : 0;
+}
+
+/**
+ * appends the data cache hit rates of a finished simulation and the misses and hit rate of every thread
+ * @param name - name of the model
+ */
+static void appendCache(CORE_Sim* sim, const char* name, int threads, string& out){
+    cache_stats total;
+    CORE_GetCacheStats(sim, &total);
+    appendf(out, "\n%s data cache hit rate %lf, loads %.0f hit rate %lf, stores %.0f hit rate %lf", name,
+            hitRate(total.loadHits + total.storeHits, total.loads + total.stores), total.loads,
+            hitRate(total.loadHits, total.loads), total.stores, hitRate(total.storeHits, total.stores));
+    appendf(out, "\n%s data cache misses per thread:", name);
+    for (int k = 0; k < threads; k++){
+        cache_stats thread;
+        CORE_GetThreadCacheStats(sim, k, &thread);
+        appendf(out, " %.0f", thread.loads - thread.loadHits + thread.stores - thread.storeHits);
+    }
+    appendf(out, "\n%s data cache hit rate per thread:", name);
+    for (int k = 0; k < threads; k++){
+        cache_stats thread;
+        CORE_GetThreadCacheStats(sim, k, &thread);
+        appendf(out, " %lf", hitRate(thread.loadHits + thread.storeHits, thread.loads + thread.stores));
+    }
+}
+
+/**
+ * appends the memory requests of a finished simulation, their mean queueing delay and that of every thread
+ * @param name - name of the model
+ */
+static void appendMemory(CORE_Sim* sim, const char* name, int threads, string& out){
+    memory_stats total;
+    CORE_GetMemoryStats(sim, &total);
+    appendf(out, "\n%s memory requests %.0f, queueing cycles %.0f, mean queueing delay %lf", name, total.requests,
+            total.queueCycles, total.requests > 0 ? total.queueCycles / total.requests : 0);
+    appendf(out, "\n%s memory queueing cycles per thread:", name);
+    for (int k = 0; k < threads; k++){
+        memory_stats thread;
+        CORE_GetThreadMemoryStats(sim, k, &thread);
+        appendf(out, " %.0f", thread.queueCycles);
+    }
+}
+
+static const char* modelName(core_model model){
+    switch (model) {
+        case CORE_MODEL_BLOCKED: return "Blocked MT";
+        case CORE_MODEL_FINEGRAINED: return "Finegrained MT";
+        default: return "SMT";
+    }
+}
+
+/**
+ * runs one core model and appends its register files and CPI
+ * @param ctx - image to simulate
+ * @param rm - core model to run
+ * @param out - string to append to
+ * @param json - string to append the cycle accounting of the model to, NULL to skip it
+ * @param trace - trace to add the model to, NULL to skip it
+ * @return false if the simulation could not be created, or json was asked from a build without stats
+ */
+static bool reportModel(SIM_Context* ctx, const ReportModel& rm, string& out, string* json, SIM_Trace* trace){
+    core_model model = rm.model;
+    CORE_Sim* sim = CORE_Create(ctx, model);
+    if (sim == NULL)
+        return false;
+    if ((model == CORE_MODEL_SMT && CORE_SetIssue(sim, rm.width, rm.memPorts) != 0) ||
+        (rm.cache != NULL && CORE_SetCache(sim, rm.cache) != 0) ||
+        (rm.memory != NULL && CORE_SetMemory(sim, rm.memory) != 0) ||
+        (rm.storeBuffer > 0 && CORE_SetScoreboard(sim, rm.storeBuffer) != 0)){
+        CORE_Destroy(sim);
+        return false;
+    }
+    int threads = SIM_CtxGetThreadsNum(ctx);
+    int cores = CORE_GetCoresNum(sim);
+    vector<vector<int> > coreThreads(cores);
+    for (int k = 0; k < threads; k++)
+        coreThreads[cores > 1 ? SIM_CtxGetThreadCore(ctx, k) : 0].push_back(k);
+    for (int c = 0; trace != NULL && c < cores; c++){ // a process per core
+        string name = modelName(model);
+        if (cores > 1)
+            appendf(name, " core %d", c);
+        CORE_SetCoreTrace(sim, c, TRACE_AddProcess(trace, name.c_str(), (int)coreThreads[c].size()));
+    }
+    CORE_Run(sim);
+
+    vector<tcontext> regs(threads > 0 ? threads : 1);
+    if (model == CORE_MODEL_BLOCKED)
+        appendf(out, "\n---- Blocked MT Simulation ----\n");
+    else if (model == CORE_MODEL_FINEGRAINED)
+        appendf(out, "\n-----Finegrained MT Simulation -----\n");
+    else
+        appendf(out, "\n-----SMT Simulation (width %d, %d memory ports) -----\n", rm.width, rm.memPorts);
+    for (int k = 0; k < threads; k++){
+        CORE_GetCTX(sim, &regs[0], k);
+        appendf(out, "\nRegister file thread id %d:\n", k);
+        for (int i = 0; i < REGS_COUNT; ++i)
+            appendf(out, "\tR%d = 0x%X", i, regs[k].reg[i]);
+    }
+    if (cores > 1)
+        appendf(out, "\n");
+    for (int c = 0; cores > 1 && c < cores; c++){
+        if (coreThreads[c].empty()) // no instructions to take a CPI over
+            continue;
+        appendf(out, "\n%s core %d CPI %lf, threads", modelName(model), c, CORE_GetCoreCPI(sim, c));
+        for (size_t k = 0; k < coreThreads[c].size(); k++)
+            appendf(out, " %d", coreThreads[c][k]);
+    }
+    if (rm.cache != NULL)
+        appendCache(sim, modelName(model), threads, out);
+    if (rm.memory != NULL)
+        appendMemory(sim, modelName(model), threads, out);
+    if (model == CORE_MODEL_BLOCKED)
+        appendf(out, "\nBlocked MT CPI for this program %lf\n", CORE_GetCPI(sim));
+    else if (model == CORE_MODEL_FINEGRAINED)
+        appendf(out, "\nFinegrained Multithreading CPI for this program %lf\n\n", CORE_GetCPI(sim));
+    else
+        appendf(out, "\nSMT CPI for this program %lf\n\n", CORE_GetCPI(sim));
+    bool ok = (json == NULL) || appendStats(sim, threads, *json);
+    CORE_Destroy(sim);
+    return ok;
+}
+
+/**
+ * runs all models at once, each on its own snapshot of the image memory
+ * @param ctx - image to simulate, its memory is not changed
+ * @param models - models to run
+ * @param out - string to append to, the reports of the models in their order
+ * @param json - cycle accounting of every model, NULL to skip it
+ * @return false if a simulation could not be created
+ */
+static bool reportIndependent(SIM_Context* ctx, const vector<ReportModel>& models, string& out, vector<string>* json,
+                              SIM_Trace* trace){
+    vector<SIM_Context*> snapshots(models.size());
+    vector<string> outs(models.size());
+    vector<char> ok(models.size(), false);
+    bool created = true;
+    for (size_t m = 0; m < models.size(); m++){
+        snapshots[m] = SIM_CtxSnapshot(ctx);
+        created = created && snapshots[m] != NULL;
+    }
+    if (created){
+        vector<thread> runs;
+        for (size_t m = 1; m < models.size(); m++){
+            runs.push_back(thread([&, m](){
+                ok[m] = reportModel(snapshots[m], models[m], outs[m], json ? &(*json)[m] : NULL, trace);
+            }));
+        }
+        ok[0] = reportModel(snapshots[0], models[0], outs[0], json ? &(*json)[0] : NULL, trace);
+        for (size_t r = 0; r < runs.size(); r++)
+            runs[r].join();
+    }
+    bool allOk = created;
+    for (size_t m = 0; m < models.size(); m++){
+        SIM_CtxFree(snapshots[m]);
+        out += outs[m];
+        allOk = allOk && ok[m];
+    }
+    return allOk;
+}
+
+/**
+ * @return a malloc'd copy of a string, NULL if out of memory
+ */
+static char* copyString(const string& str){
+    char* res = (char*)malloc(str.size() + 1);
+    if (res != NULL)
+        memcpy(res, str.c_str(), str.size() + 1);
+    return res;
+}
+
+char *REPORT_RunWith(SIM_Context *ctx, report_mode mode, const report_options *options){
+    char** statsJson = (options == NULL) ? NULL : options->statsJson;
+    SIM_Trace* trace = (options == NULL) ? NULL : options->trace;
+    if (ctx == NULL)
+        return NULL;
+    const cache_config* cache = (options == NULL) ? NULL : options->cache;
+    const memory_config* memory = (options == NULL) ? NULL : options->memory;
+    int storeBuffer = (options == NULL) ? 0 : options->storeBuffer;
+    vector<ReportModel> models;
+    ReportModel blocked = {CORE_MODEL_BLOCKED, 1, 1, cache, memory, storeBuffer};
+    ReportModel fg = {CORE_MODEL_FINEGRAINED, 1, 1, cache, memory, storeBuffer};
+    models.push_back(blocked);
+    models.push_back(fg);
+    if (options != NULL && options->smtWidth > 0){
+        ReportModel smt = {CORE_MODEL_SMT, options->smtWidth, options->smtMemPorts, cache, memory, storeBuffer};
+        models.push_back(smt);
+    }
+    string out;
+    vector<string> json(models.size());
+    vector<string>* stats = (statsJson == NULL) ? NULL : &json;
+    if (mode == REPORT_INDEPENDENT){
+        if (!reportIndependent(ctx, models, out, stats, trace))
+            return NULL;
+    }
+    else {
+        for (size_t m = 0; m < models.size(); m++) // every model starts from the memory the one before left
+            if (!reportModel(ctx, models[m], out, stats ? &json[m] : NULL, trace))
+                return NULL;
+    }
+    char* res = copyString(out);
+    if (res != NULL && statsJson != NULL){
+        static const char* keys[] = {"blocked", "finegrained", "smt"};
+        string all = "{";
+        for (size_t m = 0; m < models.size(); m++)
+            all += string(m ? "," : "") + "\n  \"" + keys[models[m].model] + "\": " + json[m];
+        *statsJson = copyString(all + "\n}\n");
+        if (*statsJson == NULL){
+            free(res);
+            return NULL;
+        }
+    }
+    return res;
+}
+
+/**
+ * sets up a simulation of a policy table as the report options ask
+ * @param options - data cache, bounded memory and scoreboard mode of the core, NULL for none
+ * @return false if an option does not apply
+ */
+static bool applyOptions(CORE_Sim* sim, const report_options* options){
+    return options == NULL ||
+           ((options->cache == NULL || CORE_SetCache(sim, options->cache) == 0) &&
+            (options->memory == NULL || CORE_SetMemory(sim, options->memory) == 0) &&
+            (options->storeBuffer <= 0 || CORE_SetScoreboard(sim, options->storeBuffer) == 0));
+}
+
+/**
+ * runs fine-grained MT with one policy on a snapshot of the image
+ * @param options - data cache, bounded memory and scoreboard mode of the core, NULL for none
+ * @return false if the simulation could not be created
+ */
+static bool runPolicy(const SIM_Context* ctx, core_policy policy, const int* weights, int weightsCount,
+                      const report_options* options, double& cpi, double& fairness){
+    SIM_Context* snapshot = SIM_CtxSnapshot(ctx);
+    CORE_Sim* sim = CORE_CreateFinegrained(snapshot, policy);
+    if (sim == NULL || !applyOptions(sim, options)){
+        CORE_Destroy(sim);
+        SIM_CtxFree(snapshot);
+        return false;
+    }
+    if (policy == CORE_POLICY_WEIGHTED && weights != NULL){
+        for (int tid = 0; tid < weightsCount && tid < SIM_CtxGetThreadsNum(ctx); tid++){
+            if (CORE_SetThreadWeight(sim, tid, weights[tid]) != 0){
+                CORE_Destroy(sim);
+                SIM_CtxFree(snapshot);
+                return false;
+            }
+        }
+    }
+    CORE_Run(sim);
+    cpi = CORE_GetCPI(sim);
+    fairness = CORE_GetFairness(sim);
+    CORE_Destroy(sim);
+    SIM_CtxFree(snapshot);
+    return true;
+}
+
+char *REPORT_Policies(SIM_Context *ctx, const int *weights, int weightsCount, const report_options *options){
+    if (ctx == NULL)
+        return NULL;
+    vector<double> cpi(CORE_POLICY_COUNT), fairness(CORE_POLICY_COUNT);
+    vector<char> ok(CORE_POLICY_COUNT, false);
+    vector<thread> runs;
+    for (int policy = 1; policy < CORE_POLICY_COUNT; policy++){ // all at once, each on its own snapshot
+        runs.push_back(thread([&, policy](){
+            ok[policy] = runPolicy(ctx, (core_policy)policy, weights, weightsCount, options, cpi[policy],
+                                     fairness[policy]);
+        }));
+    }
+    ok[0] = runPolicy(ctx, (core_policy)0, weights, weightsCount, options, cpi[0], fairness[0]);
+    for (size_t r = 0; r < runs.size(); r++)
+        runs[r].join();
+    string out = "-----Finegrained MT thread selection policies -----\n\n";
+    appendf(out, "%-14s %10s %10s\n", "policy", "CPI", "fairness");
+    for (int policy = 0; policy < CORE_POLICY_COUNT; policy++){
+        if (!ok[policy])
+            return NULL;
+        appendf(out, "%-14s %10f %10f\n", CORE_PolicyName((core_policy)policy), cpi[policy], fairness[policy]);
+    }
+    return copyString(out);
+}
+
+/**
+ * runs blocked MT with one switch policy on a snapshot of the image
+ * @param options - data cache, bounded memory and scoreboard mode of the core, NULL for none
+ * @return false if the simulation could not be created
+ */
+static bool runSwitchPolicy(const SIM_Context* ctx, core_switch policy, int threshold, const report_options* options,
+                            double& cpi){
+    SIM_Context* snapshot = SIM_CtxSnapshot(ctx);
+    CORE_Sim* sim = CORE_Create(snapshot, CORE_MODEL_BLOCKED);
+    if (sim == NULL || CORE_SetSwitchPolicy(sim, policy, threshold) != 0 || !applyOptions(sim, options)){
+        CORE_Destroy(sim);
+        SIM_CtxFree(snapshot);
+        return false;
+    }
+    CORE_Run(sim);
+    cpi = CORE_GetCPI(sim);
+    CORE_Destroy(sim);
+    SIM_CtxFree(snapshot);
+    return true;
+}
+
+char *REPORT_SwitchPolicies(SIM_Context *ctx, int threshold, const report_options *options){
+    if (ctx == NULL)
+        return NULL;
+    if (threshold < 0)
+        threshold = SIM_CtxGetSwitchCycles(ctx);
+    vector<double> cpi(CORE_SWITCH_COUNT);
+    vector<char> ok(CORE_SWITCH_COUNT, false);
+    vector<thread> runs;
+    for (int policy = 1; policy < CORE_SWITCH_COUNT; policy++){ // all at once, each on its own snapshot
+        runs.push_back(thread([&, policy](){
+            ok[policy] = runSwitchPolicy(ctx, (core_switch)policy, threshold, options, cpi[policy]);
+        }));
+    }
+    ok[0] = runSwitchPolicy(ctx, (core_switch)0, threshold, options, cpi[0]);
+    for (size_t r = 0; r < runs.size(); r++)
+        runs[r].join();
+    string out = "-----Blocked MT switch policies -----\n\n";
+    appendf(out, "%-14s %10s\n", "policy", "CPI");
+    int best = 0;
+    for (int policy = 0; policy < CORE_SWITCH_COUNT; policy++){
+        if (!ok[policy])
+            return NULL;
+        appendf(out, "%-14s %10f\n", CORE_SwitchName((core_switch)policy), cpi[policy]);
+        if (cpi[policy] < cpi[best]) // ties go to the earlier policy
+            best = policy;
+    }
+    appendf(out, "\nLowest CPI with %s switching (threshold %d)\n", CORE_SwitchName((core_switch)best), threshold);
+    return copyString(out);
+}
+
+char *REPORT_Run(SIM_Context *ctx, report_mode mode){
+    return REPORT_RunWith(ctx, mode, NULL);
+}
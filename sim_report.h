@@ -0,0 +1,73 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+
+#ifndef SIM_REPORT_H_
+#define SIM_REPORT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "core_api.h"
+#include "sim_trace.h"
+
+/* How the two core models share the data memory of an image */
+typedef enum {
+	REPORT_SHARED_MEMORY = 0, // blocked MT runs first and fine-grained MT starts from the memory it left
+	REPORT_INDEPENDENT,       // each model runs concurrently on its own snapshot of the loaded memory
+} report_mode;
+
+/*! REPORT_Run: Simulate an image under blocked MT and fine-grained MT
+  \param[in] ctx The loaded image. In REPORT_SHARED_MEMORY mode both models write its data memory,
+                 in REPORT_INDEPENDENT mode it is left untouched.
+  \param[in] mode How the models share the data memory
+  \returns the register files and CPI of both models, as printed by sim_main, with the CPI of every core
+           for images that run on several cores. The caller frees the string. NULL in case of error.
+*/
+char *REPORT_Run(SIM_Context *ctx, report_mode mode);
+
+/* What REPORT_RunWith collects besides the report, every member may be NULL */
+typedef struct {
+	char **statsJson; // set to a JSON object with a "blocked" and a "finegrained" member, each holding the
+	                  // core_stats of the model, its CPI and a "threads" array of thread_stats with the IPC
+	                  // of every thread. The caller frees the string. Needs a build with SIM_STATS defined.
+	SIM_Trace *trace; // the scheduling of both models is traced into it, a process per model and core
+	int smtWidth; // >0 to also simulate SMT with this issue width, last, as an "smt" report and stats member
+	int smtMemPorts; // memory ports of the SMT simulation
+	const cache_config *cache; // data cache of every core of every model, reported with its hit rates and the
+	                           // misses of every thread. NULL for none, LOADs and STOREs take L and S cycles
+	const memory_config *memory; // memory requests every core has in flight, reported with the queueing delay
+	                             // of every thread. NULL for unbounded
+	int storeBuffer; // >0 to run every model in scoreboard mode with this many store buffer entries per thread,
+	                 // see CORE_SetScoreboard
+} report_options;
+
+/*! REPORT_RunWith: REPORT_Run, also collecting what the options ask for
+  \returns the report of REPORT_Run, NULL in case of error or if stats were asked from a build without them
+*/
+char *REPORT_RunWith(SIM_Context *ctx, report_mode mode, const report_options *options);
+
+/*! REPORT_Policies: Simulate an image under fine-grained MT with every thread selection policy of core_policy
+  \param[in] ctx The loaded image, every policy runs on its own snapshot of it so its memory is not changed
+  \param[in] weights Weight of every thread under CORE_POLICY_WEIGHTED, threads past weightsCount weigh 1
+  \param[in] options The data cache, bounded memory and scoreboard mode every policy runs with, the other
+                     members are not used. NULL for none
+  \returns a table of the CPI and Jain's fairness index of every policy, see CORE_GetFairness.
+           The caller frees the string. NULL in case of error.
+*/
+char *REPORT_Policies(SIM_Context *ctx, const int *weights, int weightsCount, const report_options *options);
+
+/*! REPORT_SwitchPolicies: Simulate an image under blocked MT with every switch policy of core_switch
+  \param[in] ctx The loaded image, every policy runs on its own snapshot of it, sharing its program
+  \param[in] threshold Hold cycles CORE_SWITCH_THRESHOLD waits out, <0 for the O of the image
+  \param[in] options The data cache, bounded memory and scoreboard mode every policy runs with, the other
+                     members are not used. NULL for none
+  \returns a table of the CPI of every policy and the policy with the lowest CPI.
+           The caller frees the string. NULL in case of error.
+*/
+char *REPORT_SwitchPolicies(SIM_Context *ctx, int threshold, const report_options *options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM_REPORT_H_ */
@@ -0,0 +1,214 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+/* Latency / switch overhead / thread count sweeps     */
+
+#include "core_api.h"
+#include "sim_api.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * inclusive range of a swept parameter
+ */
+struct SweepRange{
+    int first;
+    int last;
+    int step;
+
+    int count() const{
+        return (last - first) / step + 1;
+    }
+    int at(int i) const{
+        return first + i * step;
+    }
+};
+
+/**
+ * one point of the sweep grid and the CPI of both models in it
+ */
+struct SweepPoint{
+    int threads;
+    int loadLat;
+    int storeLat;
+    int switchCycles;
+    double blockedCPI;
+    double fgCPI;
+};
+
+/**
+ * parses "<first>", "<first>:<last>" or "<first>:<last>:<step>"
+ * @return false if the range is malformed
+ */
+static bool parseRange(const char* str, SweepRange& range){
+    int first, last, step;
+    int fields = sscanf(str, "%d:%d:%d", &first, &last, &step);
+    if (fields < 1)
+        return false;
+    if (fields < 2)
+        last = first;
+    if (fields < 3)
+        step = 1;
+    if (step <= 0 || last < first)
+        return false;
+    range.first = first;
+    range.last = last;
+    range.step = step;
+    return true;
+}
+
+/**
+ * runs one model over a private snapshot of the image with the point's parameters
+ * @return CPI of the run, -1 if it could not be created
+ */
+static double runPoint(const SIM_Context* image, const SweepPoint& point, core_model model){
+    SIM_Context* ctx = SIM_CtxSnapshot(image);
+    if (ctx == NULL)
+        return -1;
+    SIM_CtxSetParams(ctx, point.loadLat, point.storeLat, point.switchCycles);
+    SIM_CtxSetThreadsNum(ctx, point.threads);
+    double cpi = -1;
+    CORE_Sim* sim = CORE_Create(ctx, model);
+    if (sim != NULL){
+        CORE_Run(sim);
+        cpi = CORE_GetCPI(sim);
+        CORE_Destroy(sim);
+    }
+    SIM_CtxFree(ctx);
+    return cpi;
+}
+
+/**
+ * writes the CPI matrix of one model: a row for every (threads, load, store) and a column for every switch overhead
+ * @return false if the file could not be written
+ */
+static bool writeMatrix(const string& fname, const vector<SweepPoint>& points, const SweepRange& switchRange,
+                        bool blocked){
+    FILE* out = fname.empty() ? stdout : fopen(fname.c_str(), "w");
+    if (out == NULL)
+        return false;
+    if (fname.empty())
+        fprintf(out, "# %s MT CPI\n", blocked ? "Blocked" : "Finegrained");
+    fprintf(out, "threads,load,store");
+    for (int o = 0; o < switchRange.count(); o++)
+        fprintf(out, ",O=%d", switchRange.at(o));
+    fprintf(out, "\n");
+    // points are ordered with the switch overhead varying fastest
+    for (size_t row = 0; row < points.size(); row += switchRange.count()){
+        fprintf(out, "%d,%d,%d", points[row].threads, points[row].loadLat, points[row].storeLat);
+        for (int o = 0; o < switchRange.count(); o++){
+            const SweepPoint& point = points[row + o];
+            fprintf(out, ",%f", blocked ? point.blockedCPI : point.fgCPI);
+        }
+        fprintf(out, "\n");
+    }
+    if (out != stdout)
+        fclose(out);
+    return true;
+}
+
+static void usage(const char* prog){
+    fprintf(stderr, "usage: %s [-L range] [-S range] [-O range] [-N range] [-j threads] [-o prefix] <memory image>\n", prog);
+    fprintf(stderr, "  ranges are <first>[:<last>[:<step>]] and default to the value in the image\n");
+    fprintf(stderr, "  -L load latency, -S store latency, -O switch overhead, -N number of threads (the first ones)\n");
+    fprintf(stderr, "  -o writes <prefix>_blocked.csv and <prefix>_finegrained.csv instead of printing both matrices\n");
+}
+
+int main(int argc, char const *argv[]){
+    const char* memFname = NULL;
+    const char* ranges[4] = {NULL, NULL, NULL, NULL}; // L, S, O, N
+    string prefix;
+    int workers = thread::hardware_concurrency();
+    for (int i = 1; i < argc; i++){
+        string arg = argv[i];
+        if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc){
+            switch (arg[1]) {
+                case 'L': ranges[0] = argv[++i]; continue;
+                case 'S': ranges[1] = argv[++i]; continue;
+                case 'O': ranges[2] = argv[++i]; continue;
+                case 'N': ranges[3] = argv[++i]; continue;
+                case 'j': workers = atoi(argv[++i]); continue;
+                case 'o': prefix = argv[++i]; continue;
+            }
+        }
+        if (arg[0] == '-' || memFname != NULL){
+            usage(argv[0]);
+            return 1;
+        }
+        memFname = argv[i];
+    }
+    if (memFname == NULL){
+        usage(argv[0]);
+        return 1;
+    }
+    if (workers < 1)
+        workers = 1;
+
+    SIM_Context* image = SIM_CtxCreate(memFname); // the program is parsed once for the whole sweep
+    if (image == NULL){
+        fprintf(stderr, "Failed initializing memory simulator!\n");
+        return 2;
+    }
+    int defaults[4] = {SIM_CtxGetLoadLat(image), SIM_CtxGetStoreLat(image), SIM_CtxGetSwitchCycles(image),
+                       SIM_CtxGetThreadsNum(image)};
+    SweepRange range[4];
+    for (int r = 0; r < 4; r++){
+        range[r].first = range[r].last = defaults[r];
+        range[r].step = 1;
+        if (ranges[r] != NULL && !parseRange(ranges[r], range[r])){
+            fprintf(stderr, "Bad range: %s\n", ranges[r]);
+            SIM_CtxFree(image);
+            return 1;
+        }
+    }
+    if (range[3].first < 1 || range[3].last > defaults[3]){ // no threads run no instructions to take a CPI over
+        fprintf(stderr, "Thread count must be between 1 and %d\n", defaults[3]);
+        SIM_CtxFree(image);
+        return 1;
+    }
+
+    vector<SweepPoint> points;
+    for (int n = 0; n < range[3].count(); n++)
+        for (int l = 0; l < range[0].count(); l++)
+            for (int s = 0; s < range[1].count(); s++)
+                for (int o = 0; o < range[2].count(); o++){
+                    SweepPoint point = {range[3].at(n), range[0].at(l), range[1].at(s), range[2].at(o), 0, 0};
+                    points.push_back(point);
+                }
+
+    // every worker takes the next grid point that was not taken yet
+    atomic<size_t> next(0);
+    vector<thread> pool;
+    for (int w = 0; w < workers; w++){
+        pool.push_back(thread([&points, &next, image](){
+            for (size_t p = next++; p < points.size(); p = next++){
+                points[p].blockedCPI = runPoint(image, points[p], CORE_MODEL_BLOCKED);
+                points[p].fgCPI = runPoint(image, points[p], CORE_MODEL_FINEGRAINED);
+            }
+        }));
+    }
+    for (size_t w = 0; w < pool.size(); w++)
+        pool[w].join();
+    SIM_CtxFree(image);
+
+    bool ok;
+    if (prefix.empty()){
+        ok = writeMatrix("", points, range[2], true);
+        printf("\n");
+        ok = ok && writeMatrix("", points, range[2], false);
+    }
+    else {
+        ok = writeMatrix(prefix + "_blocked.csv", points, range[2], true) &&
+             writeMatrix(prefix + "_finegrained.csv", points, range[2], false);
+    }
+    if (!ok){
+        fprintf(stderr, "Failed writing the results!\n");
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,259 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+/* Chrome trace-event writer                           */
+
+#include "sim_trace.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+static const size_t chunkEvents = 1 << 16; // events a process buffers before handing them to the writer
+static const size_t maxPending = 4; // buffers that may wait for the writer before simulations wait for it
+static const size_t fileBuffer = 1 << 20;
+
+static const char* kindStr[] = {"exec", "load", "store", "switch", "idle"};
+
+struct TraceEvent{
+    long long start;
+    long long duration;
+    int tid;
+    int kind;
+};
+
+/**
+ * events of a process handed to the writer, or the naming of a new process
+ */
+struct TraceChunk{
+    TRACE_Process* process;
+    bool names; // write the names of the process and its tracks instead of events
+    vector<TraceEvent> events;
+};
+
+struct _trace_process{
+    SIM_Trace* trace;
+    int pid;
+    string name;
+    int threads;
+    vector<TraceEvent> events;
+};
+
+struct _sim_trace{
+    FILE* out;
+    long long firstCycle;
+    long long lastCycle; // <0 for no limit
+    vector<TRACE_Process*> processes;
+    mutex lock; // guards everything below
+    condition_variable ready; // the writer has chunks to write
+    condition_variable space; // the writer took a chunk
+    deque<TraceChunk> pending;
+    vector<vector<TraceEvent> > spare; // written buffers, reused by the processes
+    bool closing;
+    bool firstRecord; // no record was written yet, so the next one needs no comma
+    bool failed;
+    thread writer;
+};
+
+/**
+ * writes a record of the traceEvents array
+ */
+static void writeRecord(SIM_Trace* trace, const char* record){
+    if ((!trace->firstRecord && fputs(",\n", trace->out) == EOF) || fputs(record, trace->out) == EOF)
+        trace->failed = true;
+    trace->firstRecord = false;
+}
+
+/**
+ * writes the metadata that names a process and its tracks
+ */
+static void writeNames(SIM_Trace* trace, const TRACE_Process* process){
+    char record[256];
+    snprintf(record, sizeof(record), "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}",
+             process->pid, process->name.c_str());
+    writeRecord(trace, record);
+    for (int tid = 0; tid <= process->threads; tid++){
+        char name[32];
+        if (tid < process->threads)
+            snprintf(name, sizeof(name), "thread %d", tid);
+        else
+            snprintf(name, sizeof(name), "core");
+        snprintf(record, sizeof(record), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                 "\"args\":{\"name\":\"%s\"}}", process->pid, tid, name);
+        writeRecord(trace, record);
+    }
+}
+
+/**
+ * appends the decimal digits of a non-negative number
+ * @return end of the digits
+ */
+static char* appendNumber(char* out, long long value){
+    char digits[24];
+    int len = 0;
+    do {
+        digits[len++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (len > 0)
+        *out++ = digits[--len];
+    return out;
+}
+
+static char* appendStr(char* out, const char* str){
+    while (*str != '\0')
+        *out++ = *str++;
+    return out;
+}
+
+/**
+ * writes the slices of a chunk. they are formatted by hand since snprintf would bound the writer, and thus
+ * the traced simulations, to a fraction of the rate they produce slices at
+ */
+static void writeChunk(SIM_Trace* trace, const TraceChunk& chunk){
+    if (chunk.names){
+        writeNames(trace, chunk.process);
+        return;
+    }
+    char record[160];
+    for (size_t i = 0; i < chunk.events.size(); i++){
+        const TraceEvent& event = chunk.events[i];
+        char* end = appendStr(record, "{\"name\":\"");
+        end = appendStr(end, kindStr[event.kind]);
+        end = appendStr(end, "\",\"ph\":\"X\",\"pid\":");
+        end = appendNumber(end, chunk.process->pid);
+        end = appendStr(end, ",\"tid\":");
+        end = appendNumber(end, event.tid);
+        end = appendStr(end, ",\"ts\":");
+        end = appendNumber(end, event.start);
+        end = appendStr(end, ",\"dur\":");
+        end = appendNumber(end, event.duration);
+        *end++ = '}';
+        *end = '\0';
+        writeRecord(trace, record);
+    }
+}
+
+/**
+ * the background thread: writes the chunks in the order they were handed over, until the trace closes
+ */
+static void writerLoop(SIM_Trace* trace){
+    unique_lock<mutex> guard(trace->lock);
+    while (true){
+        while (trace->pending.empty() && !trace->closing)
+            trace->ready.wait(guard);
+        if (trace->pending.empty())
+            return;
+        TraceChunk chunk = move(trace->pending.front());
+        trace->pending.pop_front();
+        trace->space.notify_all();
+        guard.unlock();
+        writeChunk(trace, chunk);
+        chunk.events.clear();
+        guard.lock();
+        if (chunk.events.capacity() > 0)
+            trace->spare.push_back(move(chunk.events));
+    }
+}
+
+/**
+ * hands a chunk to the writer, waiting while too many chunks are pending
+ */
+static void submit(SIM_Trace* trace, TraceChunk& chunk){
+    unique_lock<mutex> guard(trace->lock);
+    while (trace->pending.size() >= maxPending)
+        trace->space.wait(guard);
+    trace->pending.push_back(move(chunk));
+    trace->ready.notify_one();
+}
+
+SIM_Trace *TRACE_Open(const char *fname, long long firstCycle, long long lastCycle){
+    FILE* out = fopen(fname, "w");
+    if (out == NULL)
+        return NULL;
+    setvbuf(out, NULL, _IOFBF, fileBuffer);
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    SIM_Trace* trace = new SIM_Trace();
+    trace->out = out;
+    trace->firstCycle = firstCycle;
+    trace->lastCycle = lastCycle;
+    trace->closing = false;
+    trace->firstRecord = true;
+    trace->failed = false;
+    trace->writer = thread(writerLoop, trace);
+    return trace;
+}
+
+TRACE_Process *TRACE_AddProcess(SIM_Trace *trace, const char *name, int threads){
+    TRACE_Process* process = new TRACE_Process();
+    process->trace = trace;
+    process->name = name;
+    process->threads = threads;
+    process->events.reserve(chunkEvents);
+    {
+        lock_guard<mutex> guard(trace->lock);
+        process->pid = (int)trace->processes.size();
+        trace->processes.push_back(process);
+    }
+    TraceChunk names = {process, true, vector<TraceEvent>()};
+    submit(trace, names);
+    return process;
+}
+
+void TRACE_Event(TRACE_Process *process, int tid, trace_kind kind, long long start, long long duration){
+    const SIM_Trace* trace = process->trace;
+    long long end = start + duration;
+    if (start < trace->firstCycle)
+        start = trace->firstCycle;
+    if (trace->lastCycle >= 0 && end > trace->lastCycle + 1)
+        end = trace->lastCycle + 1;
+    if (end <= start) // out of the window
+        return;
+    TraceEvent event = {start, end - start, tid, kind};
+    process->events.push_back(event);
+    if (process->events.size() >= chunkEvents)
+        TRACE_Flush(process);
+}
+
+void TRACE_Flush(TRACE_Process *process){
+    if (process->events.empty())
+        return;
+    SIM_Trace* trace = process->trace;
+    TraceChunk chunk = {process, false, vector<TraceEvent>()};
+    chunk.events.swap(process->events);
+    submit(trace, chunk);
+    lock_guard<mutex> guard(trace->lock);
+    if (!trace->spare.empty()){ // continue in a written buffer
+        process->events.swap(trace->spare.back());
+        trace->spare.pop_back();
+    }
+    else {
+        process->events.reserve(chunkEvents);
+    }
+}
+
+int TRACE_Close(SIM_Trace *trace){
+    if (trace == NULL)
+        return -1;
+    for (size_t i = 0; i < trace->processes.size(); i++)
+        TRACE_Flush(trace->processes[i]);
+    {
+        lock_guard<mutex> guard(trace->lock);
+        trace->closing = true;
+        trace->ready.notify_one();
+    }
+    trace->writer.join();
+    fprintf(trace->out, "\n]}\n");
+    bool failed = trace->failed || ferror(trace->out);
+    if (fclose(trace->out) != 0)
+        failed = true;
+    for (size_t i = 0; i < trace->processes.size(); i++)
+        delete trace->processes[i];
+    delete trace;
+    return failed ? -1 : 0;
+}
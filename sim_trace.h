@@ -0,0 +1,66 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+
+#ifndef SIM_TRACE_H_
+#define SIM_TRACE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************/
+/* Scheduling timeline traces                */
+/*********************************************/
+/* A trace is a Chrome trace-event JSON file (chrome://tracing, ui.perfetto.dev) with a process per simulation,
+   a track per simulated thread plus a "core" track, and a slice per execute, load or store stall, context switch
+   and idle period. A cycle is shown as a microsecond.
+   Simulations hand their events to a background thread that formats and writes them. At most a few buffers of
+   events wait for it, beyond that the simulation waits, so tracing slows a run down by a bounded factor. */
+
+typedef struct _sim_trace SIM_Trace;
+
+/* The events of one simulation in a trace, to be used by one host thread at a time */
+typedef struct _trace_process TRACE_Process;
+
+typedef enum {
+	TRACE_EXEC = 0, // a thread executed an instruction
+	TRACE_LOAD, // a thread waited on a load
+	TRACE_STORE, // a thread waited on a store
+	TRACE_SWITCH, // the core switched to a thread
+	TRACE_IDLE, // no thread could run, on the core track
+} trace_kind;
+
+/*! TRACE_Open: Start writing a trace
+  \param[in] fname Trace file to write
+  \param[in] firstCycle First cycle to trace
+  \param[in] lastCycle Last cycle to trace, <0 for the whole run. Slices are clipped to the window.
+  \returns the trace, NULL in case of error.
+*/
+SIM_Trace *TRACE_Open(const char *fname, long long firstCycle, long long lastCycle);
+
+/*! TRACE_AddProcess: Add the process of a simulation to a trace
+  \param[in] name Name of the process
+  \param[in] threads Number of simulated threads, the core track comes after them
+  \returns the process, valid until the trace is closed. NULL in case of error.
+*/
+TRACE_Process *TRACE_AddProcess(SIM_Trace *trace, const char *name, int threads);
+
+/*! TRACE_Event: Add a slice to a track of a process
+  \param[in] tid Simulated thread of the slice, the number of threads for the core track
+  \param[in] start First cycle of the slice
+  \param[in] duration Number of cycles of the slice
+*/
+void TRACE_Event(TRACE_Process *process, int tid, trace_kind kind, long long start, long long duration);
+
+/*! TRACE_Flush: Hand the buffered events of a process to the writer, done before the simulation is freed */
+void TRACE_Flush(TRACE_Process *process);
+
+/*! TRACE_Close: Write the remaining events and close the trace, after all its simulations are done
+  \returns 0 - for success, <0 if the trace could not be written.
+*/
+int TRACE_Close(SIM_Trace *trace);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM_TRACE_H_ */
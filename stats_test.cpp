@@ -0,0 +1,885 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+/* Checks the features of the simulator, built with     */
+/* SIM_STATS defined, each selected by -f <feature>:    */
+/*   accounting - every cycle of every model accounted  */
+/*   smt        - SMT of width 1 runs like fine-grained */
+/*   policies   - picks of thread selection policies    */
+/*   cache      - data cache hits, victims, latencies   */
+/*   memory     - queueing of LOADs for the memory      */
+/*   scoreboard - issue and stalls in scoreboard mode   */
+/*   switch     - costs and picks of switch policies    */
+/*   cores      - multi-core runs repeat exactly        */
+
+#include "core_api.h"
+#include "sim_api.h"
+#include "sim_report.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <fstream>
+#include <math.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+static bool endsWith(const string& str, const string& suffix){
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/**
+ * adds the images of a path, directories contribute their .in and .img files
+ * @return false if the path does not exist
+ */
+static bool collectImages(const string& path, vector<string>& images){
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    if (!S_ISDIR(st.st_mode)){
+        images.push_back(path);
+        return true;
+    }
+    DIR* dir = opendir(path.c_str());
+    if (dir == NULL)
+        return false;
+    vector<string> found;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL){
+        string name = entry->d_name;
+        if (endsWith(name, ".in") || endsWith(name, ".img"))
+            found.push_back(path + "/" + name);
+    }
+    closedir(dir);
+    sort(found.begin(), found.end());
+    images.insert(images.end(), found.begin(), found.end());
+    return true;
+}
+
+static const int smtWidth = 4;
+static const int smtMemPorts = 2;
+
+/**
+ * runs a model and checks that its accounting adds up: every cycle is an exec, switch or idle cycle,
+ * every instruction belongs to a thread, the accounting agrees with the CPI and the fairness index is in range
+ * @param policy - thread selection policy of fine-grained MT
+ * @return an empty string if it does, what does not add up otherwise
+ */
+static string checkModel(SIM_Context* ctx, core_model model, core_policy policy = CORE_POLICY_ROUND_ROBIN){
+    CORE_Sim* sim = (model == CORE_MODEL_FINEGRAINED) ? CORE_CreateFinegrained(ctx, policy) : CORE_Create(ctx, model);
+    if (model == CORE_MODEL_SMT)
+        CORE_SetIssue(sim, smtWidth, smtMemPorts);
+    CORE_Run(sim);
+    core_stats core;
+    string error;
+    if (CORE_GetStats(sim, &core) != 0){
+        CORE_Destroy(sim);
+        return "no stats";
+    }
+    if (core.execCycles + core.switchCycles + core.idleCycles != core.cycles * CORE_GetCoresNum(sim))
+        error = "cycles";
+    if (model != CORE_MODEL_SMT && core.execCycles != core.instructions)
+        error = "exec cycles";
+    if (model == CORE_MODEL_SMT && (core.execCycles > core.instructions || core.instructions > smtWidth * core.execCycles))
+        error = "issued instructions";
+    if (model != CORE_MODEL_BLOCKED && core.switchCycles != 0)
+        error = "switch cycles";
+    if (core.cycles / core.instructions != CORE_GetCPI(sim) && core.instructions > 0)
+        error = "CPI";
+    double instructions = 0;
+    for (int tid = 0; tid < SIM_CtxGetThreadsNum(ctx); tid++){
+        thread_stats thread;
+        CORE_GetThreadStats(sim, tid, &thread);
+        instructions += thread.instructions;
+        if (thread.haltCycle > core.cycles)
+            error = "halt cycle";
+    }
+    if (instructions != core.instructions)
+        error = "thread instructions";
+    double fairness = CORE_GetFairness(sim);
+    int threads = SIM_CtxGetThreadsNum(ctx);
+    if (threads > 0 && !(fairness <= 1 + 1e-9 && fairness >= 1.0 / threads - 1e-9))
+        error = "fairness";
+    CORE_Destroy(sim);
+    return error;
+}
+
+static const cache_config testCaches[] = {{64, 2, 16, 1, 7, CORE_CACHE_LRU}, {256, 4, 8, 2, 9, CORE_CACHE_PLRU}};
+
+/**
+ * runs a model with a data cache and checks that every LOAD and STORE held its thread for the hit or miss
+ * latency it was counted as, and that the accesses of the threads add up to those of the simulation
+ * @return an empty string if they do, what does not add up otherwise
+ */
+static string checkCache(const SIM_Context* ctx, core_model model, const cache_config& config){
+    SIM_Context* snapshot = SIM_CtxSnapshot(ctx);
+    CORE_Sim* sim = CORE_Create(snapshot, model);
+    string error;
+    if (CORE_SetCache(sim, &config) != 0)
+        error = "cache config";
+    CORE_Run(sim);
+    cache_stats total, sum = {0, 0, 0, 0};
+    if (error.empty() && CORE_GetCacheStats(sim, &total) != 0)
+        error = "no cache stats";
+    for (int tid = 0; error.empty() && tid < SIM_CtxGetThreadsNum(ctx); tid++){
+        thread_stats thread;
+        cache_stats cache;
+        CORE_GetThreadStats(sim, tid, &thread);
+        CORE_GetThreadCacheStats(sim, tid, &cache);
+        if (thread.loadStallCycles != cache.loadHits * config.hitLat + (cache.loads - cache.loadHits) * config.missLat)
+            error = "load latencies";
+        if (thread.storeStallCycles != cache.storeHits * config.hitLat + (cache.stores - cache.storeHits) * config.missLat)
+            error = "store latencies";
+        sum.loads += cache.loads;
+        sum.loadHits += cache.loadHits;
+        sum.stores += cache.stores;
+        sum.storeHits += cache.storeHits;
+    }
+    if (error.empty() && (sum.loads != total.loads || sum.loadHits != total.loadHits || sum.stores != total.stores ||
+                          sum.storeHits != total.storeHits))
+        error = "thread cache accesses";
+    CORE_Destroy(sim);
+    SIM_CtxFree(snapshot);
+    return error;
+}
+
+/**
+ * runs a model with bounded memory and checks that every LOAD held its thread for L cycles and its queueing
+ * delay. with as many requests in flight and started per cycle as there are threads no LOAD may queue, since
+ * a thread waits on one LOAD at a time
+ * @return an empty string if it does, what does not add up otherwise
+ */
+static string checkMemory(const SIM_Context* ctx, core_model model, const memory_config& config){
+    SIM_Context* snapshot = SIM_CtxSnapshot(ctx);
+    CORE_Sim* sim = CORE_Create(snapshot, model);
+    string error;
+    if (CORE_SetMemory(sim, &config) != 0)
+        error = "memory config";
+    CORE_Run(sim);
+    int threads = SIM_CtxGetThreadsNum(ctx);
+    memory_stats total;
+    if (error.empty() && CORE_GetMemoryStats(sim, &total) != 0)
+        error = "no memory stats";
+    if (error.empty() && config.outstanding >= threads && config.bandwidth >= threads && total.queueCycles != 0)
+        error = "queued without contention";
+    for (int tid = 0; error.empty() && tid < threads; tid++){
+        thread_stats thread;
+        memory_stats memory;
+        CORE_GetThreadStats(sim, tid, &thread);
+        CORE_GetThreadMemoryStats(sim, tid, &memory);
+        if (thread.loadStallCycles != memory.requests * max(SIM_CtxGetLoadLat(ctx), 0) + memory.queueCycles)
+            error = "load latencies";
+    }
+    CORE_Destroy(sim);
+    SIM_CtxFree(snapshot);
+    return error;
+}
+
+/**
+ * runs a model in scoreboard mode and checks that its accounting adds up. a single thread computes the same
+ * registers as without the scoreboard, in no more cycles, since it only ever stalls later
+ * @return an empty string if it does, what does not add up otherwise
+ */
+static string checkScoreboard(const SIM_Context* ctx, core_model model, int storeBuffer){
+    SIM_Context* plainCtx = SIM_CtxSnapshot(ctx);
+    SIM_Context* scoreCtx = SIM_CtxSnapshot(ctx);
+    CORE_Sim* plain = CORE_Create(plainCtx, model);
+    CORE_Sim* score = CORE_Create(scoreCtx, model);
+    string error;
+    if (CORE_SetScoreboard(score, storeBuffer) != 0)
+        error = "scoreboard config";
+    CORE_Run(plain);
+    CORE_Run(score);
+    core_stats core;
+    CORE_GetStats(score, &core);
+    if (core.execCycles + core.switchCycles + core.idleCycles != core.cycles * CORE_GetCoresNum(score))
+        error = "cycles";
+    int threads = SIM_CtxGetThreadsNum(ctx);
+    if (threads == 1){
+        tcontext plainRegs, scoreRegs;
+        CORE_GetCTX(plain, &plainRegs, 0);
+        CORE_GetCTX(score, &scoreRegs, 0);
+        for (int i = 0; i < REGS_COUNT; i++)
+            if (plainRegs.reg[i] != scoreRegs.reg[i])
+                error = "registers";
+        if (CORE_GetCPI(score) > CORE_GetCPI(plain))
+            error = "CPI";
+    }
+    CORE_Destroy(score);
+    CORE_Destroy(plain);
+    SIM_CtxFree(scoreCtx);
+    SIM_CtxFree(plainCtx);
+    return error;
+}
+
+/**
+ * runs blocked MT under a switch policy and checks that its accounting adds up, and that switching on every
+ * hold, or on every hold with more than 0 cycles left, schedules like blocked MT without a policy
+ * @return an empty string if it does, what does not add up otherwise
+ */
+static string checkSwitch(const SIM_Context* ctx, core_switch policy, int threshold){
+    SIM_Context* plainCtx = SIM_CtxSnapshot(ctx);
+    SIM_Context* switchCtx = SIM_CtxSnapshot(ctx);
+    CORE_Sim* plain = CORE_Create(plainCtx, CORE_MODEL_BLOCKED);
+    CORE_Sim* sim = CORE_Create(switchCtx, CORE_MODEL_BLOCKED);
+    string error;
+    if (CORE_SetSwitchPolicy(sim, policy, threshold) != 0)
+        error = "switch policy";
+    CORE_Run(plain);
+    CORE_Run(sim);
+    core_stats core;
+    CORE_GetStats(sim, &core);
+    if (core.execCycles + core.switchCycles + core.idleCycles != core.cycles * CORE_GetCoresNum(sim) ||
+        core.execCycles != core.instructions)
+        error = "cycles";
+    bool sameCPI = CORE_GetCPI(sim) == CORE_GetCPI(plain) || (isnan(CORE_GetCPI(sim)) && isnan(CORE_GetCPI(plain)));
+    if ((policy == CORE_SWITCH_ON_HOLD || (policy == CORE_SWITCH_THRESHOLD && threshold == 0)) && !sameCPI)
+        error = "CPI";
+    CORE_Destroy(sim);
+    CORE_Destroy(plain);
+    SIM_CtxFree(switchCtx);
+    SIM_CtxFree(plainCtx);
+    return error;
+}
+
+/**
+ * loads an image held in a string, for the checks of behaviour the corpora do not pin down
+ */
+static SIM_Context* createImage(const string& image){
+    return SIM_CtxCreateFromBuffer(image.data(), image.size(), "stats_test");
+}
+
+/**
+ * @return the code block of a thread of an image: a LOAD if load is set, then count ADDIs and a HALT
+ */
+static string threadCode(int tid, bool load, int count){
+    string code = "T" + to_string(tid) + "\nI@0x00000000\n";
+    if (load)
+        code += "LOAD $1, $0, 0x0\n";
+    for (int i = 0; i < count; i++)
+        code += "ADDI $2, $2, 0x1\n";
+    return code + "HALT $0\n\n";
+}
+
+/**
+ * runs fine-grained MT under a policy on a snapshot of the image
+ * @param weight - weight of thread 0, under CORE_POLICY_WEIGHTED
+ * @param threads - threads of the image to run
+ * @return the cycle in which thread 0 halted
+ */
+static double threadZeroHalt(const SIM_Context* ctx, core_policy policy, int weight, int threads){
+    SIM_Context* snapshot = SIM_CtxSnapshot(ctx);
+    SIM_CtxSetThreadsNum(snapshot, threads);
+    CORE_Sim* sim = CORE_CreateFinegrained(snapshot, policy);
+    if (policy == CORE_POLICY_WEIGHTED)
+        CORE_SetThreadWeight(sim, 0, weight);
+    CORE_Run(sim);
+    thread_stats thread;
+    CORE_GetThreadStats(sim, 0, &thread);
+    CORE_Destroy(sim);
+    SIM_CtxFree(snapshot);
+    return thread.haltCycle;
+}
+
+/**
+ * @param table - a policy table of sim_report.h, a row of a name and a CPI per policy
+ * @return the CPI column of a policy's row as printed, empty if it has none
+ */
+static string tableCPI(const char* table, const char* name){
+    char cpi[32];
+    string row = "\n" + string(name) + " ";
+    const char* found = (table == NULL) ? NULL : strstr(table, row.c_str());
+    if (found == NULL || sscanf(found + row.size(), "%31s", cpi) != 1)
+        return "";
+    return cpi;
+}
+
+/**
+ * @return a CPI as the policy tables print it
+ */
+static string printedCPI(double cpi){
+    char printed[32];
+    snprintf(printed, sizeof(printed), "%f", cpi);
+    return printed;
+}
+
+/**
+ * runs a single thread that loads the given addresses in order with a data cache
+ * @return the LOADs that hit, -1 if the run failed
+ */
+static double cacheHits(const vector<int>& addrs, const cache_config& config){
+    string image = "L2\nS2\nO2\nN1\n\nT0\nI@0x00000000\n";
+    for (size_t i = 0; i < addrs.size(); i++)
+        image += "LOAD $1, $0, " + to_string(addrs[i]) + "\n";
+    SIM_Context* ctx = createImage(image + "HALT $0\n");
+    CORE_Sim* sim = (ctx == NULL) ? NULL : CORE_Create(ctx, CORE_MODEL_BLOCKED);
+    cache_stats stats;
+    stats.loadHits = -1;
+    if (sim != NULL && CORE_SetCache(sim, &config) == 0){
+        CORE_Run(sim);
+        CORE_GetCacheStats(sim, &stats);
+    }
+    CORE_Destroy(sim);
+    SIM_CtxFree(ctx);
+    return stats.loadHits;
+}
+
+/**
+ * checks which LOADs hit the data cache on sequences whose hits are known up front, with lines of 16 bytes:
+ * a LOAD of the line the LOAD before brought in hits, a third line of a set of 2 ways evicts the least recently
+ * used one, and on a set of 4 ways LRU and tree PLRU evict different lines
+ * @return an empty string if they do, what does not otherwise
+ */
+static string checkCacheHits(){
+    cache_config twoSets = {64, 2, 16, 1, 7, CORE_CACHE_LRU}; // lines 0, 2 and 4 share set 0
+    cache_config oneSet = {64, 4, 16, 1, 7, CORE_CACHE_LRU};
+    if (cacheHits({0x0, 0x4, 0xC}, twoSets) != 2)
+        return "same line";
+    if (cacheHits({0x0, 0x20, 0x40, 0x0}, twoSets) != 0 || cacheHits({0x0, 0x20, 0x10, 0x0}, twoSets) != 1)
+        return "conflict miss";
+    // lines A B C D C E A: LRU evicts A for E, the tree points at B and keeps A
+    vector<int> lines = {0x0, 0x10, 0x20, 0x30, 0x20, 0x40, 0x0};
+    if (cacheHits(lines, oneSet) != 1)
+        return "LRU victim";
+    oneSet.replacement = CORE_CACHE_PLRU;
+    if (cacheHits(lines, oneSet) != 2)
+        return "PLRU victim";
+    return "";
+}
+
+/**
+ * checks that the thread selection policies pick the threads they are meant to: doubling the weight of a thread
+ * under CORE_POLICY_WEIGHTED lets it halt sooner, and under CORE_POLICY_ICOUNT a thread back from a LOAD runs
+ * ahead of a thread that executed more, as if it ran alone, which round robin does not let it. the policy table
+ * runs the policies with the data cache of the report
+ * @return an empty string if they do, what does not otherwise
+ */
+static string checkPolicies(){
+    string error;
+    SIM_Context* alu = createImage("L4\nS4\nO2\nN2\n\n" + threadCode(0, false, 12) + threadCode(1, false, 12));
+    SIM_Context* load = createImage("L6\nS4\nO2\nN2\n\n" + threadCode(0, true, 4) + threadCode(1, false, 12));
+    if (alu == NULL || load == NULL)
+        error = "load";
+    else if (!(threadZeroHalt(alu, CORE_POLICY_WEIGHTED, 2, 2) < threadZeroHalt(alu, CORE_POLICY_WEIGHTED, 1, 2)))
+        error = "weighted share";
+    else if (threadZeroHalt(load, CORE_POLICY_ICOUNT, 1, 2) != threadZeroHalt(load, CORE_POLICY_ICOUNT, 1, 1) ||
+             !(threadZeroHalt(load, CORE_POLICY_ROUND_ROBIN, 1, 2) > threadZeroHalt(load, CORE_POLICY_ICOUNT, 1, 2)))
+        error = "icount pick";
+    if (error.empty()){ // the table runs every policy with the data cache of the report
+        report_options options = {NULL, NULL, 0, 0, &testCaches[0], NULL, 0};
+        SIM_Context* miss = createImage("L2\nS2\nO2\nN1\n\n" + threadCode(0, true, 1)); // waits on its miss
+        CORE_Sim* sim = CORE_Create(miss, CORE_MODEL_FINEGRAINED);
+        CORE_SetCache(sim, &testCaches[0]);
+        CORE_Run(sim);
+        char* table = REPORT_Policies(miss, NULL, 0, &options);
+        if (tableCPI(table, CORE_PolicyName(CORE_POLICY_ROUND_ROBIN)) != printedCPI(CORE_GetCPI(sim)))
+            error = "table options";
+        free(table);
+        CORE_Destroy(sim);
+        SIM_CtxFree(miss);
+    }
+    if (error.empty()){
+        CORE_Sim* sim = CORE_CreateFinegrained(alu, CORE_POLICY_WEIGHTED);
+        if (CORE_SetThreadWeight(sim, 0, CORE_MAX_THREAD_WEIGHT) != 0 ||
+            CORE_SetThreadWeight(sim, 0, CORE_MAX_THREAD_WEIGHT + 1) == 0 || CORE_SetThreadWeight(sim, -1, 1) == 0 ||
+            CORE_SetThreadWeight(sim, 2, 1) == 0)
+            error = "weight range";
+        CORE_Destroy(sim);
+    }
+    SIM_CtxFree(load);
+    SIM_CtxFree(alu);
+    return error;
+}
+
+/**
+ * runs fine-grained MT over threads that all start with a LOAD, with a single request in flight at a time, and
+ * checks that the LOADs queue and start one after the other, each once the one before completed, and that the
+ * queueing costs cycles over unbounded memory
+ * @return an empty string if they do, what does not otherwise
+ */
+static string checkContention(){
+    const int threads = 4, loadLat = 10;
+    string image = "L" + to_string(loadLat) + "\nS2\nO2\nN" + to_string(threads) + "\n\n";
+    for (int tid = 0; tid < threads; tid++)
+        image += threadCode(tid, true, 2);
+    SIM_Context* boundedCtx = createImage(image);
+    SIM_Context* unboundedCtx = createImage(image);
+    if (boundedCtx == NULL || unboundedCtx == NULL){
+        SIM_CtxFree(unboundedCtx);
+        SIM_CtxFree(boundedCtx);
+        return "load";
+    }
+    CORE_Sim* bounded = CORE_Create(boundedCtx, CORE_MODEL_FINEGRAINED);
+    CORE_Sim* unbounded = CORE_Create(unboundedCtx, CORE_MODEL_FINEGRAINED);
+    memory_config single = {1, 1};
+    string error;
+    if (CORE_SetMemory(bounded, &single) != 0)
+        error = "memory config";
+    CORE_Run(bounded);
+    CORE_Run(unbounded);
+    memory_stats total;
+    CORE_GetMemoryStats(bounded, &total);
+    if (error.empty() && !(total.queueCycles > 0))
+        error = "no queueing";
+    double lastStart = -loadLat;
+    for (int tid = 0; error.empty() && tid < threads; tid++){ // round robin issues the LOAD of thread tid in cycle tid
+        memory_stats memory;
+        CORE_GetThreadMemoryStats(bounded, tid, &memory);
+        double start = tid + memory.queueCycles;
+        if (start - lastStart != loadLat)
+            error = "LOADs not serialized";
+        lastStart = start;
+    }
+    if (error.empty() && !(CORE_GetCPI(bounded) >= CORE_GetCPI(unbounded)))
+        error = "CPI below unbounded memory";
+    CORE_Destroy(unbounded);
+    CORE_Destroy(bounded);
+    SIM_CtxFree(unboundedCtx);
+    SIM_CtxFree(boundedCtx);
+    return error;
+}
+
+/**
+ * runs fine-grained MT in scoreboard mode
+ * @param storeBuffer - store buffer entries of every thread
+ * @return the cycle in which a thread halted, -1 if the run failed
+ */
+static double scoreboardHalt(const string& image, core_policy policy, int storeBuffer, int tid){
+    SIM_Context* ctx = createImage(image);
+    CORE_Sim* sim = (ctx == NULL) ? NULL : CORE_CreateFinegrained(ctx, policy);
+    thread_stats thread;
+    thread.haltCycle = -1;
+    if (sim != NULL && CORE_SetScoreboard(sim, storeBuffer) == 0){
+        CORE_Run(sim);
+        CORE_GetThreadStats(sim, tid, &thread);
+    }
+    CORE_Destroy(sim);
+    SIM_CtxFree(ctx);
+    return thread.haltCycle;
+}
+
+/**
+ * checks when instructions issue in scoreboard mode on single threads: the instructions after a LOAD that do not
+ * read its register issue in the cycles right after it, the first that does waits out the LOAD latency like a
+ * held thread, STOREs retire at once while their buffer has a free entry and wait for the oldest to drain once it
+ * is full. under CORE_POLICY_ICOUNT the outstanding LOADs of a thread count against it
+ * @return an empty string if they do, what does not otherwise
+ */
+static string checkScoreboardIssue(){
+    const double loadLat = 5, storeLat = 5;
+    string thread = "L5\nS5\nO2\nN1\n\nT0\nI@0x00000000\n", halt = "HALT $0\n";
+    string adds = "ADDI $2, $2, 0x1\nADDI $3, $3, 0x1\n";
+    if (scoreboardHalt(thread + "LOAD $1, $0, 0x0\n" + adds + halt, CORE_POLICY_ROUND_ROBIN, 1, 0) !=
+        scoreboardHalt(thread + "ADDI $1, $0, 0x0\n" + adds + halt, CORE_POLICY_ROUND_ROBIN, 1, 0))
+        return "independent instructions held";
+    if (scoreboardHalt(thread + "LOAD $1, $0, 0x0\nADDI $2, $1, 0x1\n" + halt, CORE_POLICY_ROUND_ROBIN, 1, 0) !=
+        scoreboardHalt(thread + "LOAD $1, $0, 0x0\nADDI $2, $3, 0x1\n" + halt, CORE_POLICY_ROUND_ROBIN, 1, 0) + loadLat)
+        return "reader of the LOAD";
+    string stores = "STORE $0, $0, 0x0\nSTORE $0, $0, 0x4\n";
+    if (scoreboardHalt(thread + stores + adds + halt, CORE_POLICY_ROUND_ROBIN, 2, 0) !=
+        scoreboardHalt(thread + adds + adds + halt, CORE_POLICY_ROUND_ROBIN, 2, 0))
+        return "STORE with free entries held";
+    // the third STORE issues a cycle after the second and waits until the first drained, storeLat after it issued
+    if (scoreboardHalt(thread + stores + "STORE $0, $0, 0x8\n" + halt, CORE_POLICY_ROUND_ROBIN, 2, 0) !=
+        scoreboardHalt(thread + adds + "ADDI $2, $2, 0x1\n" + halt, CORE_POLICY_ROUND_ROBIN, 2, 0) + storeLat - 1)
+        return "STORE with a full buffer";
+    string loads = "L20\nS2\nO2\nN2\n\nT0\nI@0x00000000\n"; // thread 1 has LOADs outstanding as it goes on
+    for (int i = 0; i < 6; i++)
+        loads += "ADDI $2, $2, 0x1\n";
+    loads += halt + "\nT1\nI@0x00000000\n";
+    for (int reg = 1; reg <= 6; reg++)
+        loads += "LOAD $" + to_string(reg) + ", $0, 0x0\n";
+    loads += halt;
+    if (!(scoreboardHalt(loads, CORE_POLICY_ICOUNT, 1, 0) < scoreboardHalt(loads, CORE_POLICY_ROUND_ROBIN, 1, 0)))
+        return "icount outstanding LOADs";
+    return "";
+}
+
+/**
+ * runs blocked MT under a switch policy on a snapshot of the image
+ * @param threads - threads of the image to run
+ * @param core - set to the cycle accounting of the run
+ * @return the cycle in which thread 0 halted
+ */
+static double runSwitch(const SIM_Context* ctx, core_switch policy, int threshold, int threads, core_stats& core,
+                        double& cpi){
+    SIM_Context* snapshot = SIM_CtxSnapshot(ctx);
+    SIM_CtxSetThreadsNum(snapshot, threads);
+    CORE_Sim* sim = CORE_Create(snapshot, CORE_MODEL_BLOCKED);
+    CORE_SetSwitchPolicy(sim, policy, threshold);
+    CORE_Run(sim);
+    thread_stats thread;
+    CORE_GetStats(sim, &core);
+    CORE_GetThreadStats(sim, 0, &thread);
+    cpi = CORE_GetCPI(sim);
+    CORE_Destroy(sim);
+    SIM_CtxFree(snapshot);
+    return thread.haltCycle;
+}
+
+/**
+ * checks what the switch policies cost and when they switch, on images where that is known up front:
+ * a flush costs a cycle per ALU instruction and two per LOAD or STORE the thread issued in its last O issue
+ * slots, at least one. ON_LOAD waits out a STORE, so the thread halts as if it ran alone. And the report of
+ * the policies picks the one with the lowest CPI, and run like sim_main on the image as loaded, with the data
+ * cache of the report, its ON_HOLD row is the CPI blocked MT reported
+ * @return an empty string if they do, what does not otherwise
+ */
+static string checkSwitchPolicies(){
+    // thread 0 switches after its LOAD, thread 1 when it halts: 2 + 4 ADDIs, and 2 + at least 1 for a HALT
+    SIM_Context* flush = createImage("L2\nS2\nO5\nN2\n\n" + threadCode(0, true, 0) + threadCode(1, false, 4));
+    SIM_Context* halt = createImage("L2\nS2\nO5\nN2\n\n" + threadCode(0, true, 0) + threadCode(1, false, 0));
+    SIM_Context* store = createImage("L2\nS3\nO2\nN2\n\nT0\nI@0x00000000\nSTORE $0, $0, 0x0\nADDI $1, $1, 0x1\n"
+                                     "HALT $0\n\n" + threadCode(1, false, 3));
+    string error;
+    if (flush == NULL || halt == NULL || store == NULL)
+        error = "load";
+    core_stats core;
+    double cpi;
+    if (error.empty()){
+        runSwitch(flush, CORE_SWITCH_FLUSH, 0, 2, core, cpi);
+        if (core.switchCycles != 2 + 4)
+            error = "flush cost";
+        runSwitch(halt, CORE_SWITCH_FLUSH, 0, 2, core, cpi);
+        if (core.switchCycles != 2 + 1)
+            error = "flush cost";
+    }
+    if (error.empty()){
+        double alone = runSwitch(store, CORE_SWITCH_ON_LOAD, 0, 1, core, cpi);
+        if (runSwitch(store, CORE_SWITCH_ON_LOAD, 0, 2, core, cpi) != alone || core.switchCycles != 2)
+            error = "switched on a STORE";
+    }
+    for (int image = 0; image < 2 && error.empty(); image++){
+        SIM_Context* ctx = image ? store : flush;
+        int best = 0;
+        double bestCPI = 0;
+        for (int policy = 0; policy < CORE_SWITCH_COUNT; policy++){
+            runSwitch(ctx, (core_switch)policy, SIM_CtxGetSwitchCycles(ctx), SIM_CtxGetThreadsNum(ctx), core, cpi);
+            if (policy == 0 || cpi < bestCPI){ // ties go to the earlier policy
+                best = policy;
+                bestCPI = cpi;
+            }
+        }
+        char* report = REPORT_SwitchPolicies(ctx, -1, NULL);
+        string picked = string("Lowest CPI with ") + CORE_SwitchName((core_switch)best) + " switching";
+        if (report == NULL || string(report).find(picked) == string::npos)
+            error = "report pick";
+        free(report);
+    }
+    // the thread loads through a pointer within the line of the pointer, then points it to another line
+    SIM_Context* pointer = createImage("L2\nS2\nO2\nN1\n\nT0\nI@0x00000000\nLOAD $1, $0, 0x100\nLOAD $2, $1, 0x0\n"
+                                       "ADDI $3, $0, 0x200\nSTORE $0, $3, 0x100\nHALT $0\n\nD@0x100\n0x104\n");
+    SIM_Context* loaded = (pointer == NULL) ? NULL : SIM_CtxSnapshot(pointer);
+    if (error.empty() && loaded == NULL)
+        error = "load";
+    if (error.empty()){
+        report_options options = {NULL, NULL, 0, 0, &testCaches[0], NULL, 0};
+        char* report = REPORT_RunWith(pointer, REPORT_SHARED_MEMORY, &options); // writes the pointer
+        char* table = REPORT_SwitchPolicies(loaded, -1, &options);
+        const char* blocked = (report == NULL) ? NULL : strstr(report, "Blocked MT CPI for this program ");
+        string blockedCPI = (blocked == NULL) ? "" : string(blocked + strlen("Blocked MT CPI for this program "));
+        blockedCPI = blockedCPI.substr(0, blockedCPI.find('\n'));
+        if (blockedCPI.empty() || tableCPI(table, CORE_SwitchName(CORE_SWITCH_ON_HOLD)) != blockedCPI)
+            error = "on-hold row";
+        free(table);
+        free(report);
+    }
+    SIM_CtxFree(loaded);
+    SIM_CtxFree(pointer);
+    SIM_CtxFree(store);
+    SIM_CtxFree(halt);
+    SIM_CtxFree(flush);
+    return error;
+}
+
+/**
+ * @return the binary image of a context as it is now, its data memory included, empty if it cannot be written
+ */
+static string savedImage(const SIM_Context* ctx){
+    char fname[] = "/tmp/stats_test_XXXXXX";
+    int fd = mkstemp(fname);
+    if (fd < 0)
+        return "";
+    close(fd);
+    string image;
+    if (SIM_CtxSave(ctx, fname) == 0){
+        ifstream in(fname, ios::in | ios::binary);
+        ostringstream buf;
+        buf << in.rdbuf();
+        image = buf.str();
+    }
+    unlink(fname);
+    return image;
+}
+
+/**
+ * the end of a multi-core run: registers of every thread, data memory and CPI
+ */
+struct CoresRun{
+    vector<int> regs;
+    string memory;
+    double cpi;
+};
+
+/**
+ * runs a model over an image whose threads are spread over cores and checks that its cycle accounting agrees
+ * with its CPI, the cycles of a run being those of its longest core
+ * @return an empty string if it does, what does not add up otherwise
+ */
+static string runCores(const string& image, core_model model, int cores, CoresRun& run){
+    SIM_Context* ctx = createImage(image);
+    if (ctx == NULL || SIM_CtxSetCores(ctx, cores, NULL) != 0){
+        SIM_CtxFree(ctx);
+        return "load";
+    }
+    CORE_Sim* sim = CORE_Create(ctx, model);
+    CORE_Run(sim);
+    string error;
+    core_stats core;
+    CORE_GetStats(sim, &core);
+    run.cpi = CORE_GetCPI(sim);
+    if (CORE_GetCoresNum(sim) != cores)
+        error = "cores";
+    if (core.cycles / core.instructions != run.cpi)
+        error = "CPI";
+    if (core.execCycles + core.switchCycles + core.idleCycles != core.cycles * cores)
+        error = "cycles";
+    int threads = SIM_CtxGetThreadsNum(ctx);
+    vector<tcontext> regs(threads);
+    for (int tid = 0; tid < threads; tid++){
+        CORE_GetCTX(sim, &regs[0], tid);
+        run.regs.insert(run.regs.end(), regs[tid].reg, regs[tid].reg + REGS_COUNT);
+    }
+    CORE_Destroy(sim);
+    run.memory = savedImage(ctx);
+    SIM_CtxFree(ctx);
+    return error;
+}
+
+/**
+ * runs an image whose threads share data across cores twice on 2 and on 3 cores, and checks that the runs of
+ * each are alike, registers, data memory and CPI, as the cores publish their stores in a fixed order
+ * @return an empty string if they are, what differs otherwise
+ */
+static string checkCores(){
+    string image = "L4\nS2\nO2\nN6\n\n";
+    for (int tid = 0; tid < 6; tid++){
+        image += "T" + to_string(tid) + "\nI@0x00000000\n";
+        image += "LOAD $1, $0, " + to_string(4 * ((tid + 1) % 6)) + "\n";
+        image += "ADDI $1, $1, " + to_string(tid + 1) + "\n";
+        image += "STORE $1, $0, " + to_string(4 * tid) + "\n";
+        image += "LOAD $2, $0, " + to_string(4 * ((tid + 2) % 6)) + "\n";
+        image += "ADD $3, $1, $2\nHALT $0\n\n";
+    }
+    image += "D@0x0\n0x1\n0x2\n0x3\n0x4\n0x5\n0x6\n";
+    for (int model = CORE_MODEL_BLOCKED; model <= CORE_MODEL_FINEGRAINED; model++){
+        for (int cores = 2; cores <= 3; cores++){
+            CoresRun first, second;
+            string error = runCores(image, (core_model)model, cores, first);
+            if (error.empty())
+                error = runCores(image, (core_model)model, cores, second);
+            if (error.empty() && (first.regs != second.regs || first.memory.empty() || first.memory != second.memory ||
+                                  first.cpi != second.cpi))
+                error = "runs differ";
+            if (!error.empty())
+                return string(model == CORE_MODEL_BLOCKED ? "blocked MT" : "fine-grained MT") + " on " +
+                       to_string(cores) + " cores " + error;
+        }
+    }
+    return "";
+}
+
+/**
+ * runs fine-grained MT and SMT of width 1, each on its own snapshot of the image
+ * @return true if both end with the same CPI and register files
+ */
+static bool checkNarrowSMT(const SIM_Context* ctx){
+    SIM_Context* fgCtx = SIM_CtxSnapshot(ctx);
+    SIM_Context* smtCtx = SIM_CtxSnapshot(ctx);
+    CORE_Sim* fg = CORE_Create(fgCtx, CORE_MODEL_FINEGRAINED);
+    CORE_Sim* smt = CORE_Create(smtCtx, CORE_MODEL_SMT);
+    CORE_SetIssue(smt, 1, 1);
+    CORE_Run(fg);
+    CORE_Run(smt);
+    bool same = CORE_GetCPI(fg) == CORE_GetCPI(smt) || (isnan(CORE_GetCPI(fg)) && isnan(CORE_GetCPI(smt)));
+    int threads = SIM_CtxGetThreadsNum(ctx);
+    vector<tcontext> fgRegs(threads > 0 ? threads : 1), smtRegs(threads > 0 ? threads : 1);
+    for (int tid = 0; tid < threads; tid++){
+        CORE_GetCTX(fg, &fgRegs[0], tid);
+        CORE_GetCTX(smt, &smtRegs[0], tid);
+        for (int i = 0; i < REGS_COUNT; i++)
+            same = same && fgRegs[tid].reg[i] == smtRegs[tid].reg[i];
+    }
+    CORE_Destroy(smt);
+    CORE_Destroy(fg);
+    SIM_CtxFree(smtCtx);
+    SIM_CtxFree(fgCtx);
+    return same;
+}
+
+/**
+ * checks the cycle accounting of every model, fine-grained MT under its default policy
+ */
+static string imageAccounting(SIM_Context* ctx){
+    string blocked = checkModel(ctx, CORE_MODEL_BLOCKED);
+    string fg = checkModel(ctx, CORE_MODEL_FINEGRAINED);
+    string smt = checkModel(ctx, CORE_MODEL_SMT);
+    if (blocked.empty() && fg.empty() && smt.empty())
+        return "";
+    return "blocked MT " + (blocked.empty() ? "ok" : blocked) + ", fine-grained MT " + (fg.empty() ? "ok" : fg) +
+           ", SMT " + (smt.empty() ? "ok" : smt);
+}
+
+static string imageNarrowSMT(SIM_Context* ctx){
+    return checkNarrowSMT(ctx) ? "" : "differs from fine-grained MT with width 1";
+}
+
+/**
+ * checks the cycle accounting of fine-grained MT under every other thread selection policy
+ */
+static string imagePolicies(SIM_Context* ctx){
+    for (int policy = 1; policy < CORE_POLICY_COUNT; policy++){
+        string error = checkModel(ctx, CORE_MODEL_FINEGRAINED, (core_policy)policy);
+        if (!error.empty())
+            return string(CORE_PolicyName((core_policy)policy)) + " " + error;
+    }
+    return "";
+}
+
+static string imageCache(SIM_Context* ctx){
+    string error;
+    for (size_t c = 0; c < sizeof(testCaches) / sizeof(testCaches[0]) && error.empty(); c++){
+        for (int model = CORE_MODEL_BLOCKED; model <= CORE_MODEL_SMT && error.empty(); model++)
+            error = checkCache(ctx, (core_model)model, testCaches[c]);
+    }
+    return error;
+}
+
+static string imageMemory(SIM_Context* ctx){
+    string error;
+    for (int model = CORE_MODEL_BLOCKED; model <= CORE_MODEL_SMT && error.empty(); model++){
+        int threads = SIM_CtxGetThreadsNum(ctx);
+        memory_config narrow = {2, 1}, wide = {threads, threads};
+        error = checkMemory(ctx, (core_model)model, narrow);
+        if (error.empty() && threads > 0)
+            error = checkMemory(ctx, (core_model)model, wide);
+    }
+    return error;
+}
+
+static string imageScoreboard(SIM_Context* ctx){
+    string error;
+    for (int model = CORE_MODEL_BLOCKED; model <= CORE_MODEL_SMT && error.empty(); model++){
+        error = checkScoreboard(ctx, (core_model)model, 1);
+        if (error.empty())
+            error = checkScoreboard(ctx, (core_model)model, 4);
+    }
+    return error;
+}
+
+/**
+ * checks every switch policy with the O of the image as its threshold, and CORE_SWITCH_THRESHOLD with 0
+ */
+static string imageSwitch(SIM_Context* ctx){
+    for (int policy = 0; policy < CORE_SWITCH_COUNT; policy++){
+        string error = checkSwitch(ctx, (core_switch)policy, max(SIM_CtxGetSwitchCycles(ctx), 0));
+        if (!error.empty())
+            return string(CORE_SwitchName((core_switch)policy)) + " " + error;
+    }
+    string error = checkSwitch(ctx, CORE_SWITCH_THRESHOLD, 0);
+    return error.empty() ? "" : string(CORE_SwitchName(CORE_SWITCH_THRESHOLD)) + " 0 " + error;
+}
+
+/**
+ * a feature the test checks, by images of its own and over every image it is given
+ */
+struct Feature{
+    const char* name;
+    string (*check)(); // NULL if it has no images of its own
+    string (*checkImage)(SIM_Context* ctx); // NULL if it checks no given image
+};
+
+static const Feature features[] = {
+    {"accounting", NULL, imageAccounting},
+    {"smt", NULL, imageNarrowSMT},
+    {"policies", checkPolicies, imagePolicies},
+    {"cache", checkCacheHits, imageCache},
+    {"memory", checkContention, imageMemory},
+    {"scoreboard", checkScoreboardIssue, imageScoreboard},
+    {"switch", checkSwitchPolicies, imageSwitch},
+    {"cores", checkCores, NULL},
+};
+static const int featuresCount = sizeof(features) / sizeof(features[0]);
+
+static void usage(const char* prog){
+    fprintf(stderr, "usage: %s [-f feature]... <image or directory>...\n", prog);
+    fprintf(stderr, "features:");
+    for (int f = 0; f < featuresCount; f++)
+        fprintf(stderr, " %s", features[f].name);
+    fprintf(stderr, ", all of them if none is given\n");
+}
+
+int main(int argc, char const *argv[]){
+    vector<char> selected(featuresCount, false);
+    bool anySelected = false;
+    vector<string> images;
+    for (int i = 1; i < argc; i++){
+        string arg = argv[i];
+        if (arg == "-f" && i + 1 < argc){
+            int f = 0;
+            while (f < featuresCount && strcmp(features[f].name, argv[i + 1]) != 0)
+                f++;
+            if (f == featuresCount){
+                fprintf(stderr, "No such feature: %s\n", argv[i + 1]);
+                usage(argv[0]);
+                return 1;
+            }
+            selected[f] = anySelected = true;
+            i++;
+        }
+        else if (!arg.empty() && arg[0] == '-'){
+            usage(argv[0]);
+            return 1;
+        }
+        else if (!collectImages(arg, images)){
+            fprintf(stderr, "No such image or directory: %s\n", arg.c_str());
+            return 2;
+        }
+    }
+    if (images.empty()){
+        usage(argv[0]);
+        return 1;
+    }
+    if (!anySelected)
+        selected.assign(featuresCount, true);
+    int failed = 0;
+    int failedChecks = 0; // of the checks over images of their own
+    for (int f = 0; f < featuresCount; f++){
+        string error = (selected[f] && features[f].check != NULL) ? features[f].check() : "";
+        if (!error.empty()){
+            printf("FAIL  %s: %s\n", features[f].name, error.c_str());
+            failedChecks++;
+        }
+    }
+    for (size_t i = 0; i < images.size(); i++){
+        SIM_Context* ctx = SIM_CtxCreate(images[i].c_str());
+        string errors = (ctx == NULL) ? ", load" : "";
+        for (int f = 0; ctx != NULL && f < featuresCount; f++){
+            string error = (selected[f] && features[f].checkImage != NULL) ? features[f].checkImage(ctx) : "";
+            if (!error.empty())
+                errors += ", " + string(features[f].name) + " " + error;
+        }
+        SIM_CtxFree(ctx);
+        if (!errors.empty()){
+            printf("FAIL  %s: %s\n", images[i].c_str(), errors.c_str() + 2);
+            failed++;
+        }
+    }
+    printf("%zu images: %zu passed every check, %d failed\n", images.size(), images.size() - failed, failed);
+    return (failed || failedChecks) ? 1 : 0;
+}
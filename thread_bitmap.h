@@ -0,0 +1,104 @@
+/* 046267 Computer Architecture - Spring 2020 - HW #4 */
+
+#ifndef THREAD_BITMAP_H_
+#define THREAD_BITMAP_H_
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * hierarchical bitmap over thread ids.
+ * level 0 holds one bit per thread, every upper level holds one bit per non-empty word of the level below it,
+ * so finding the next set bit costs one count-trailing-zeros per level instead of a scan over all threads.
+ */
+class ThreadBitmap{
+    int size;
+    std::vector<std::vector<uint64_t> > levels;
+
+    static int lowestBit(uint64_t word){
+        return __builtin_ctzll(word);
+    }
+
+    /**
+     * @param level - level to search in
+     * @param pos - first bit of the level to consider
+     * @return index of the first set bit of the level at pos or after it, -1 if there is none
+     */
+    long findFrom(int level, long pos) const{
+        const std::vector<uint64_t>& words = levels[level];
+        long word = pos >> 6;
+        if (word >= (long)words.size())
+            return -1;
+        uint64_t bits = words[word] & (~0ULL << (pos & 63));
+        if (bits)
+            return (word << 6) + lowestBit(bits);
+        if (level + 1 == (int)levels.size()){ // top level is a single word
+            return -1;
+        }
+        long nextWord = findFrom(level + 1, word + 1);
+        if (nextWord < 0)
+            return -1;
+        return (nextWord << 6) + lowestBit(words[nextWord]);
+    }
+
+public:
+    explicit ThreadBitmap(int size): size(size){
+        long bits = size;
+        do {
+            long words = (bits + 63) >> 6;
+            levels.push_back(std::vector<uint64_t>(words > 0 ? words : 1, 0));
+            bits = words;
+        } while (bits > 1);
+    }
+
+    bool test(int bit) const{
+        return (levels[0][bit >> 6] >> (bit & 63)) & 1;
+    }
+
+    void set(int bit){
+        long pos = bit;
+        for (size_t level = 0; level < levels.size(); level++){
+            uint64_t& word = levels[level][pos >> 6];
+            bool wasEmpty = (word == 0);
+            word |= 1ULL << (pos & 63);
+            if (!wasEmpty) // upper levels already mark this word
+                return;
+            pos >>= 6;
+        }
+    }
+
+    void clear(int bit){
+        long pos = bit;
+        for (size_t level = 0; level < levels.size(); level++){
+            uint64_t& word = levels[level][pos >> 6];
+            word &= ~(1ULL << (pos & 63));
+            if (word != 0) // word still has set bits, upper levels stay marked
+                return;
+            pos >>= 6;
+        }
+    }
+
+    /**
+     * @param from - first bit to consider
+     * @return the first set bit at from or after it, -1 if there is none
+     */
+    int findNext(int from) const{
+        if (from >= size)
+            return -1;
+        return (int)findFrom(0, from);
+    }
+
+    /**
+     * round robin search
+     * @param from - first bit to consider
+     * @return the first set bit at from or after it, wrapping around to 0, -1 if no bit is set
+     */
+    int findNextCyclic(int from) const{
+        int bit = findNext(from);
+        if (bit < 0 && from > 0)
+            bit = findNext(0);
+        return bit;
+    }
+};
+
+#endif /* THREAD_BITMAP_H_ */